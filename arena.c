@@ -0,0 +1,59 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Number of values the arena can hold before it grows for the first time.
+#define ARENA_INITIAL_CAPACITY (4096)
+
+struct ScratchArena *arenaCreate(void) {
+  struct ScratchArena *arena = malloc(sizeof(struct ScratchArena));
+  int32_t *values = malloc(sizeof(int32_t) * ARENA_INITIAL_CAPACITY);
+  if (!arena || !values)
+    exit(1);
+
+  (*arena) = (struct ScratchArena){values, 0, ARENA_INITIAL_CAPACITY};
+  return arena;
+}
+
+void arenaDestroy(struct ScratchArena *arena) {
+  free(arena->values);
+  free(arena);
+}
+
+int64_t arenaPush(struct ScratchArena *arena, int64_t count) {
+  assert(count >= 0);
+
+  if (arena->top + count > arena->capacity) {
+    int64_t new_capacity = arena->capacity;
+    while (arena->top + count > new_capacity)
+      new_capacity *= 2;
+
+    int32_t *values = realloc(arena->values, sizeof(int32_t) * new_capacity);
+    if (!values)
+      exit(1);
+
+    arena->values = values;
+    arena->capacity = new_capacity;
+  }
+
+  int64_t res = arena->top;
+  arena->top += count;
+  return res;
+}
+
+void arenaRewind(struct ScratchArena *arena, int64_t offset) {
+  assert(0 <= offset && offset <= arena->top);
+  arena->top = offset;
+}
+
+void arenaReset(struct ScratchArena *arena) { arena->top = 0; }
@@ -0,0 +1,37 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+
+// Bump allocated stack of int32 values, used as scratch memory by a single
+// query. Values are addressed by offsets, not pointers, because the buffer is
+// moved when it grows. Nothing is freed one by one; the query rewinds the top
+// or resets the whole arena in constant time.
+struct ScratchArena {
+  int32_t *values;
+  int64_t top, capacity;
+};
+
+// Aborts with error code 1 if could not allocate memory.
+struct ScratchArena *arenaCreate(void);
+
+void arenaDestroy(struct ScratchArena *arena);
+
+// Reserve [count] values on the top of the arena and return the offset of the
+// first one. Pointers got from [arenaAt] are invalid after this call. Aborts
+// with error code 1 if could not allocate memory.
+int64_t arenaPush(struct ScratchArena *arena, int64_t count);
+
+// Drop everything above [offset].
+void arenaRewind(struct ScratchArena *arena, int64_t offset);
+
+// Drop everything. Memory is kept for the next query.
+void arenaReset(struct ScratchArena *arena);
+
+// Pointer to the value at [offset].
+#define arenaAt(arena, offset) ((arena)->values + (offset))
+
+#endif
@@ -0,0 +1,194 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+#include "command.h"
+#include "utils.h"
+
+// Mask of the first 5 characters of a word from [loadWord].
+#define FIVE_CHARACTERS (0xFFFFFFFFFFULL)
+
+// Names of the commands in the text lines and the number of their arguments.
+static const struct {
+  const char *name;
+  int args;
+} command_names[COMMAND_END] = {
+    [COMMAND_INVALID] = {"invalid", 0},
+    [COMMAND_ADD_USER] = {"addUser", 2},
+    [COMMAND_DEL_USER] = {"delUser", 1},
+    [COMMAND_ADD_MOVIE] = {"addMovie", 2},
+    [COMMAND_DEL_MOVIE] = {"delMovie", 2},
+    [COMMAND_MARATHON] = {"marathon", 2},
+    [COMMAND_MARATHON_ALL] = {"marathonAll", 1},
+    [COMMAND_COMPACT] = {"compact", 0},
+    [COMMAND_SAVE] = {"save", 0},
+    [COMMAND_LOAD] = {"load", 0},
+};
+
+// Get the path of a save or load command from the rest of its line of
+// [length] characters, [type] is given only if it is not empty.
+static void parsePath(const char *text, int32_t length, enum command_type type,
+                      struct Command *command) {
+  assert(length <= COMMAND_MAX_PATH);
+  if (length == 0) {
+    command->type = COMMAND_INVALID;
+    return;
+  }
+
+  memcpy(command->path, text, length);
+  command->path[length] = '\0';
+  command->args[0] = length;
+  command->type = type;
+}
+
+// Get the arguments of a command from the rest of its line, [type] is given
+// only if they are correct.
+static void parseArguments(const char *text, enum command_type type,
+                           int count, struct Command *command) {
+  if (readNumbersFromBuffer(text, count, command->args))
+    command->type = type;
+  else
+    command->type = COMMAND_INVALID;
+}
+
+// [parseCommand] for the text input, reads lines until one of them gives a
+// command.
+static void parseTextCommand(struct Parser *parser, struct Command *command) {
+  struct InputLine line;
+  enum input_feedback read_line_state = INPUT_IGNORED_LINE;
+  while (read_line_state == INPUT_IGNORED_LINE)
+    read_line_state = inputReadLine(parser->input, &line);
+
+  if (read_line_state == INPUT_EOF) {
+    parser->done = 1;
+    command->type = COMMAND_END;
+    return;
+  }
+
+  if (read_line_state == INPUT_INVALID) {
+    // ERROR: Invalid input.
+    command->type = COMMAND_INVALID;
+    return;
+  }
+  // The case when input line is invalid (E.g. not ended with a '\n') and
+  // the EOF is found at the end of it.
+  else if (read_line_state == INPUT_INVALID_AND_EOF) {
+    parser->done = 1;
+    command->type = COMMAND_INVALID;
+    return;
+  }
+
+  assert(read_line_state == INPUT_OK);
+
+  // The line is parsed where the reader keeps it, whole words may be read past
+  // its end. It ends with '\n', not with '\0', and no comparison below goes
+  // on after a '\n', so what follows it does not matter.
+  const char *text = line.text;
+
+  // Now we decode a command based on the first 8 characters of the line, all
+  // command names but marathonAll are distinguished by them.
+  uint64_t head = loadWord(text);
+  if (head == loadWord("addUser "))
+    parseArguments(text + 8, COMMAND_ADD_USER, 2, command);
+  else if (head == loadWord("delUser "))
+    parseArguments(text + 8, COMMAND_DEL_USER, 1, command);
+  else if (head == loadWord("addMovie") && text[8] == ' ')
+    parseArguments(text + 9, COMMAND_ADD_MOVIE, 2, command);
+  else if (head == loadWord("delMovie") && text[8] == ' ')
+    parseArguments(text + 9, COMMAND_DEL_MOVIE, 2, command);
+  else if (head == loadWord("marathon") && text[8] == ' ')
+    parseArguments(text + 9, COMMAND_MARATHON, 2, command);
+  else if (head == loadWord("marathon") &&
+           (uint32_t)loadWord(text + 8) == (uint32_t)loadWord("All     "))
+    parseArguments(text + 12, COMMAND_MARATHON_ALL, 1, command);
+  // The only command without arguments.
+  else if (head == loadWord("compact\n"))
+    command->type = COMMAND_COMPACT;
+  // The commands with a path are told by their first 5 characters.
+  else if ((head & FIVE_CHARACTERS) == (loadWord("save    ") & FIVE_CHARACTERS))
+    parsePath(text + 5, line.length - 5, COMMAND_SAVE, command);
+  else if ((head & FIVE_CHARACTERS) == (loadWord("load    ") & FIVE_CHARACTERS))
+    parsePath(text + 5, line.length - 5, COMMAND_LOAD, command);
+  else
+    // ERROR: Unrecognized opeartion, or no space after a command.
+    command->type = COMMAND_INVALID;
+}
+
+// [parseCommand] for the binary input. The arguments are not checked here,
+// the commands check their ranges anyway.
+static void parseBinaryCommand(struct Parser *parser,
+                               struct Command *command) {
+  const char *record;
+  enum input_feedback read_state =
+      inputReadRecord(parser->input, COMMAND_RECORD_SIZE, &record);
+
+  if (read_state == INPUT_EOF) {
+    parser->done = 1;
+    command->type = COMMAND_END;
+    return;
+  } else if (read_state == INPUT_INVALID_AND_EOF) {
+    parser->done = 1;
+    command->type = COMMAND_INVALID;
+    return;
+  }
+
+  assert(read_state == INPUT_OK);
+  uint8_t opcode = record[0];
+  command->type = opcode <= COMMAND_MAX_OPCODE ? opcode : COMMAND_INVALID;
+  command->args[0] = loadInt32(record + 1);
+  command->args[1] = loadInt32(record + 5);
+}
+
+void parseCommand(struct Parser *parser, struct Command *command) {
+  if (parser->done)
+    command->type = COMMAND_END;
+  else if (parser->binary)
+    parseBinaryCommand(parser, command);
+  else
+    parseTextCommand(parser, command);
+}
+
+void commandEncode(const struct Command *command,
+                   char record[COMMAND_RECORD_SIZE]) {
+  int opcode = command->type <= COMMAND_MAX_OPCODE ? command->type : 0;
+  int args = command_names[opcode].args;
+  record[0] = opcode;
+  for (int i = 0; i < 2; ++i) {
+    uint32_t bits = i < args ? command->args[i] : 0;
+    for (int byte = 0; byte < 4; ++byte)
+      record[1 + 4 * i + byte] = bits >> (8 * byte);
+  }
+}
+
+void commandWriteBinary(struct Output *out, const struct Command *command) {
+  if (command->type == COMMAND_END)
+    return;
+
+  char record[COMMAND_RECORD_SIZE];
+  commandEncode(command, record);
+  outputString(out, OUTPUT_STDOUT, record, COMMAND_RECORD_SIZE);
+}
+
+void commandWriteText(struct Output *out, const struct Command *command) {
+  if (command->type == COMMAND_END)
+    return;
+
+  const char *name = command_names[command->type].name;
+  outputString(out, OUTPUT_STDOUT, name, strlen(name));
+  if (command->type == COMMAND_SAVE || command->type == COMMAND_LOAD) {
+    outputLiteral(out, OUTPUT_STDOUT, " ");
+    outputString(out, OUTPUT_STDOUT, command->path, command->args[0]);
+  }
+  for (int i = 0; i < command_names[command->type].args; ++i) {
+    outputLiteral(out, OUTPUT_STDOUT, " ");
+    outputInt32(out, OUTPUT_STDOUT, command->args[i]);
+  }
+
+  outputLiteral(out, OUTPUT_STDOUT, "\n");
+}
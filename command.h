@@ -0,0 +1,80 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+#include "input.h"
+#include "output.h"
+
+// Commands decoded from the input. The values are also the opcodes of the
+// binary records.
+enum command_type {
+  // A line that could not be parsed, it gives an error.
+  COMMAND_INVALID = 0,
+  COMMAND_ADD_USER = 1,
+  COMMAND_DEL_USER = 2,
+  COMMAND_ADD_MOVIE = 3,
+  COMMAND_DEL_MOVIE = 4,
+  COMMAND_MARATHON = 5,
+  COMMAND_MARATHON_ALL = 6,
+  COMMAND_COMPACT = 7,
+  // Commands with a path, only in the text input.
+  COMMAND_SAVE = 8,
+  COMMAND_LOAD = 9,
+  // There is nothing more to read.
+  COMMAND_END = 10
+};
+
+// Greatest opcode of a binary record.
+#define COMMAND_MAX_OPCODE (COMMAND_COMPACT)
+
+// A binary record is the opcode byte, followed by two int32 arguments with the
+// lowest byte first. Unused arguments should be 0.
+#define COMMAND_RECORD_SIZE (9)
+
+// Longest path of the save and load commands, after "save " in the line.
+#define COMMAND_MAX_PATH (MAX_INPUT_LINE_LENGTH - 5)
+
+struct Command {
+  enum command_type type;
+  // None command takes > 2 arguments. Save and load have the length of the
+  // path in [args[0]].
+  int32_t args[2];
+
+  // Path of the save and load commands, ended with '\0'.
+  char path[COMMAND_MAX_PATH + 1];
+};
+
+struct Parser {
+  struct InputReader *input;
+
+  // 1 if the input is made of binary records, 0 if of text lines.
+  int binary;
+
+  // 1 if the input has ended.
+  int done;
+};
+
+// Read the input until it gives a command. Gives [COMMAND_END] when there is
+// nothing more to read. Records with an unknown opcode and a record cut by the
+// end of the input are [COMMAND_INVALID], like the invalid lines.
+void parseCommand(struct Parser *parser, struct Command *command);
+
+// Store the [command] as a binary record in [record]. There are no paths in
+// the binary records, so the save and load commands get opcode 0, which gives
+// an error.
+void commandEncode(const struct Command *command,
+                   char record[COMMAND_RECORD_SIZE]);
+
+// Append the [command] as a binary record, see [commandEncode]. [COMMAND_END]
+// is not written.
+void commandWriteBinary(struct Output *out, const struct Command *command);
+
+// Append the [command] as a text line, [COMMAND_INVALID] as a line that gives
+// an error. [COMMAND_END] is not written.
+void commandWriteText(struct Output *out, const struct Command *command);
+
+#endif
@@ -0,0 +1,158 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h> // for memcpy
+
+#include "id_map.h"
+
+// Capacity of an empty map.
+#define ID_MAP_INITIAL_CAPACITY (1024)
+
+// Index of the first entry to look at for [key]. Fibonacci hashing spreads
+// consecutive keys over the whole table, then the high bits of the hash are
+// taken as the index.
+static int32_t idMapHome(const struct IdMap *map, int32_t key) {
+  uint32_t hash = (uint32_t)key * 2654435769u;
+  return (int32_t)(((uint64_t)hash * (uint32_t)map->capacity) >> 32);
+}
+
+// Allocate [capacity] free entries. Aborts with error code 1 if could not
+// allocate memory.
+static struct IdMapEntry *idMapEntriesCreate(int32_t capacity) {
+  struct IdMapEntry *entries = malloc(sizeof(struct IdMapEntry) * capacity);
+  if (!entries)
+    exit(1);
+
+  for (int32_t i = 0; i < capacity; ++i)
+    entries[i] = (struct IdMapEntry){-1, -1};
+
+  return entries;
+}
+
+// Index of the entry of [key], or of the free entry where it would go.
+static int32_t idMapFind(const struct IdMap *map, int32_t key) {
+  int32_t mask = map->capacity - 1;
+  int32_t index = idMapHome(map, key);
+  while (map->entries[index].key != -1 && map->entries[index].key != key)
+    index = (index + 1) & mask;
+
+  return index;
+}
+
+void idMapInit(struct IdMap *map) {
+  map->entries = idMapEntriesCreate(ID_MAP_INITIAL_CAPACITY);
+  map->capacity = ID_MAP_INITIAL_CAPACITY;
+  map->size = 0;
+}
+
+void idMapFree(struct IdMap *map) {
+  free(map->entries);
+  map->entries = NULL;
+  map->capacity = map->size = 0;
+}
+
+int idMapLoad(struct IdMap *map, const struct IdMapEntry *entries,
+              int32_t capacity, int32_t size) {
+  if (capacity <= 0 || (capacity & (capacity - 1)) != 0 || size < 0 ||
+      2 * (int64_t)size > capacity)
+    return 0;
+
+  map->entries = malloc(sizeof(struct IdMapEntry) * capacity);
+  if (!map->entries)
+    exit(1);
+
+  memcpy(map->entries, entries, sizeof(struct IdMapEntry) * capacity);
+  map->capacity = capacity;
+  map->size = size;
+
+  // Every key must be where a lookup finds it: in its home entry or after it
+  // with no free entry in between, and only once.
+  int32_t used = 0;
+  for (int32_t i = 0; i < capacity; ++i) {
+    int32_t key = map->entries[i].key;
+    if (key == -1)
+      continue;
+
+    if (key < 0 || idMapFind(map, key) != i) {
+      idMapFree(map);
+      return 0;
+    }
+
+    used++;
+  }
+
+  if (used != size) {
+    idMapFree(map);
+    return 0;
+  }
+
+  return 1;
+}
+
+int32_t idMapGet(const struct IdMap *map, int32_t key) {
+  assert(key >= 0);
+  return map->entries[idMapFind(map, key)].value;
+}
+
+// Double the capacity and insert all the entries again.
+static void idMapGrow(struct IdMap *map) {
+  struct IdMapEntry *old_entries = map->entries;
+  int32_t old_capacity = map->capacity;
+
+  map->capacity *= 2;
+  map->entries = idMapEntriesCreate(map->capacity);
+  for (int32_t i = 0; i < old_capacity; ++i)
+    if (old_entries[i].key != -1)
+      map->entries[idMapFind(map, old_entries[i].key)] = old_entries[i];
+
+  free(old_entries);
+}
+
+void idMapSet(struct IdMap *map, int32_t key, int32_t value) {
+  assert(key >= 0);
+  struct IdMapEntry *entry = &map->entries[idMapFind(map, key)];
+  if (entry->key == key) {
+    entry->value = value;
+    return;
+  }
+
+  if (2 * (map->size + 1) > map->capacity) {
+    idMapGrow(map);
+    entry = &map->entries[idMapFind(map, key)];
+  }
+
+  (*entry) = (struct IdMapEntry){key, value};
+  map->size++;
+}
+
+int idMapRemove(struct IdMap *map, int32_t key) {
+  assert(key >= 0);
+  int32_t mask = map->capacity - 1;
+  int32_t hole = idMapFind(map, key);
+  if (map->entries[hole].key == -1)
+    return 0;
+
+  // Move back the entries that follow in the probe sequence, if the hole is
+  // between their home and their current place. Then no lookup passes
+  // through a free entry before reaching its key, with no tombstones needed.
+  for (int32_t index = (hole + 1) & mask; map->entries[index].key != -1;
+       index = (index + 1) & mask) {
+    int32_t home = idMapHome(map, map->entries[index].key);
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      map->entries[hole] = map->entries[index];
+      hole = index;
+    }
+  }
+
+  map->entries[hole] = (struct IdMapEntry){-1, -1};
+  map->size--;
+  return 1;
+}
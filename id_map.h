@@ -0,0 +1,46 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef ID_MAP_H
+#define ID_MAP_H
+
+#include <stdint.h>
+
+struct IdMapEntry {
+  // -1 if the entry is free.
+  int32_t key;
+  int32_t value;
+};
+
+// Hash map from non-negative int32 keys to int32 values, with open addressing
+// and linear probing. Capacity is a power of two, and the map grows when it
+// gets half full, so every operation takes O(1) expected time.
+struct IdMap {
+  struct IdMapEntry *entries;
+  int32_t capacity, size;
+};
+
+// Initialize an empty map. Aborts with error code 1 if could not allocate
+// memory.
+void idMapInit(struct IdMap *map);
+
+void idMapFree(struct IdMap *map);
+
+// Initialize the map with a copy of the [capacity] entries of another map of
+// [size] keys, for example read from a file. Returns 0 if they are not a valid
+// map, which is left empty then. Aborts with error code 1 if could not
+// allocate memory.
+int idMapLoad(struct IdMap *map, const struct IdMapEntry *entries,
+              int32_t capacity, int32_t size);
+
+// Value of the [key], or -1 if it is not in the map.
+int32_t idMapGet(const struct IdMap *map, int32_t key);
+
+// Set the value of the [key], adding it if it is not in the map yet. Aborts
+// with error code 1 if could not allocate memory.
+void idMapSet(struct IdMap *map, int32_t key, int32_t value);
+
+// Remove the [key]. Returns 0 if it was not in the map, else 1.
+int idMapRemove(struct IdMap *map, int32_t key);
+
+#endif
@@ -0,0 +1,195 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+// For madvise.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "utils.h"
+
+// Size of the buffer, when the input is read block by block.
+#define INPUT_BLOCK_SIZE (1 << 20)
+
+// Map the whole regular file [reader] reads from. Returns 1 on success, 0 if
+// it is not a regular file or could not be mapped. The padding after the file
+// is an anonymous mapping of zeros that the file is mapped over, as the end of
+// the file may be the end of a page.
+static int inputMap(struct InputReader *reader) {
+  struct stat info;
+  if (fstat(reader->fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+      info.st_size <= 0)
+    return 0;
+
+  // The file may have been partly read already, start where the offset is.
+  off_t offset = lseek(reader->fd, 0, SEEK_CUR);
+  if (offset < 0 || offset > info.st_size)
+    return 0;
+
+  size_t size = info.st_size + READ_NUMBERS_PADDING;
+  void *mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return 0;
+
+  if (mmap(mem, info.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, reader->fd,
+           0) == MAP_FAILED) {
+    munmap(mem, size);
+    return 0;
+  }
+
+#ifdef MADV_SEQUENTIAL
+  madvise(mem, info.st_size, MADV_SEQUENTIAL);
+#endif
+
+  reader->data = mem;
+  reader->begin = offset;
+  reader->end = reader->capacity = info.st_size;
+  reader->mapped = 1;
+  reader->eof = 1;
+  return 1;
+}
+
+struct InputReader *inputCreate(int fd) {
+  struct InputReader *reader = malloc(sizeof(struct InputReader));
+  if (!reader)
+    exit(1);
+
+  (*reader) =
+      (struct InputReader){fd, NULL, 0, 0, 0, 0, 0, INPUT_OK, NULL, NULL};
+  if (inputMap(reader))
+    return reader;
+
+  // Zeroed, so the padding and the part not read yet can be looked at.
+  reader->data = calloc(INPUT_BLOCK_SIZE + READ_NUMBERS_PADDING, 1);
+  if (!reader->data)
+    exit(1);
+
+  reader->capacity = INPUT_BLOCK_SIZE;
+  return reader;
+}
+
+void inputDestroy(struct InputReader *reader) {
+  if (reader->mapped)
+    munmap(reader->data, reader->capacity + READ_NUMBERS_PADDING);
+  else
+    free(reader->data);
+
+  free(reader);
+}
+
+// Move the unfinished line to the front of the buffer and read the next block
+// after it. Sets [eof] if there was nothing more to read.
+static void inputFill(struct InputReader *reader) {
+  assert(!reader->mapped && !reader->eof);
+
+  size_t pending = reader->end - reader->begin;
+  memmove(reader->data, reader->data + reader->begin, pending);
+  reader->begin = 0;
+  reader->end = pending;
+  assert(reader->end < reader->capacity);
+
+  if (reader->before_read)
+    reader->before_read(reader->before_read_context);
+
+  ssize_t bytes;
+  do {
+    bytes = read(reader->fd, reader->data + reader->end,
+                 reader->capacity - reader->end);
+  } while (bytes < 0 && errno == EINTR);
+
+  // A read error is treated as the end of the input.
+  if (bytes <= 0)
+    reader->eof = 1;
+  else
+    reader->end += bytes;
+}
+
+enum input_feedback inputReadLine(struct InputReader *reader,
+                                  struct InputLine *line) {
+  for (;;) {
+    char *text = reader->data + reader->begin;
+    size_t available = reader->end - reader->begin;
+    char *newline = memchr(text, '\n', available);
+
+    if (newline) {
+      size_t length = newline - text;
+      reader->begin += length + 1;
+
+      if (reader->skipped != INPUT_OK) {
+        enum input_feedback res = reader->skipped;
+        reader->skipped = INPUT_OK;
+        return res;
+      }
+
+      if (length == 0 || text[0] == '#')
+        return INPUT_IGNORED_LINE;
+
+      // For tricky case when there is a nullbyte in the middle of the input.
+      if (length > MAX_INPUT_LINE_LENGTH || memchr(text, '\0', length))
+        return INPUT_INVALID;
+
+      (*line) = (struct InputLine){text, length};
+      return INPUT_OK;
+    }
+
+    if (reader->eof) {
+      if (available == 0 && reader->skipped == INPUT_OK)
+        return INPUT_EOF;
+
+      // In the task description in stands, that every proper input line is
+      // terminated with '\n', I treat this as an error.
+      reader->begin = reader->end;
+      reader->skipped = INPUT_OK;
+      return INPUT_INVALID_AND_EOF;
+    }
+
+    // Line is too long to be valid, it is either a comment or an error. Only
+    // remember which one and make space for the rest of it.
+    if (available > MAX_INPUT_LINE_LENGTH) {
+      if (reader->skipped == INPUT_OK)
+        reader->skipped = text[0] == '#' ? INPUT_IGNORED_LINE : INPUT_INVALID;
+
+      reader->begin = reader->end;
+    }
+
+    inputFill(reader);
+  }
+}
+
+enum input_feedback inputReadRecord(struct InputReader *reader, size_t size,
+                                    const char **record) {
+  assert(0 < size && size <= MAX_INPUT_LINE_LENGTH);
+  // Records and lines are not mixed.
+  assert(reader->skipped == INPUT_OK);
+
+  for (;;) {
+    size_t available = reader->end - reader->begin;
+    if (available >= size) {
+      (*record) = reader->data + reader->begin;
+      reader->begin += size;
+      return INPUT_OK;
+    }
+
+    if (reader->eof) {
+      if (available == 0)
+        return INPUT_EOF;
+
+      reader->begin = reader->end;
+      return INPUT_INVALID_AND_EOF;
+    }
+
+    inputFill(reader);
+  }
+}
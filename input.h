@@ -0,0 +1,78 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Max size of a VALID input line. Lines with the paths of the save and load
+// commands may be that long, all the others fit in 32 characters.
+#define MAX_INPUT_LINE_LENGTH (4096)
+
+// Return values of [inputReadLine]:
+enum input_feedback {
+  INPUT_EOF,
+  INPUT_IGNORED_LINE,
+  INPUT_INVALID,
+  INPUT_INVALID_AND_EOF,
+  INPUT_OK
+};
+
+// Reads the input in large blocks, or maps it at once if it is a regular file,
+// and hands out lines without copying them.
+struct InputReader {
+  int fd;
+
+  // Not yet returned part of the input is [data + begin, data + end). There
+  // are [READ_NUMBERS_PADDING] more readable bytes after [data + capacity].
+  char *data;
+  size_t begin, end, capacity;
+
+  // 1 if [data] is a mapping of the whole file, 0 if it is a block buffer.
+  int mapped;
+
+  // 1 if there is nothing more to read from [fd].
+  int eof;
+
+  // When a line is too long to fit in the buffer, its beginning is dropped and
+  // this holds what it will be reported as, once its end is found.
+  enum input_feedback skipped;
+
+  // Called before every read that may block, if not NULL. Used to flush the
+  // output, so an interactive user sees the answers before typing more.
+  void (*before_read)(void *context);
+  void *before_read_context;
+};
+
+// View of a line returned by [inputReadLine]. It is NOT terminated with '\0':
+// there are [length] characters, followed by '\n' and then by at least
+// [READ_NUMBERS_PADDING] readable bytes, so it can be parsed in whole words
+// where it is. Valid until the next read.
+struct InputLine {
+  const char *text;
+  int32_t length;
+};
+
+// Create a reader of [fd]. Aborts with error code 1 if could not allocate
+// memory.
+struct InputReader *inputCreate(int fd);
+
+void inputDestroy(struct InputReader *reader);
+
+// Read the next line. It is stored in [line] only if INPUT_OK is returned.
+// Empty lines and comments (starting with '#') are ignored. Lines longer than
+// [MAX_INPUT_LINE_LENGTH] or containing '\0' are invalid. Every line must end
+// with '\n', so a non-empty last line without it gives INPUT_INVALID_AND_EOF.
+enum input_feedback inputReadLine(struct InputReader *reader,
+                                  struct InputLine *line);
+
+// Read the next record of [size] bytes, for binary input. Its beginning is
+// stored in [record] only if INPUT_OK is returned, it is valid until the next
+// read. If the input ends inside a record, INPUT_INVALID_AND_EOF is returned.
+// [size] must be positive and at most [MAX_INPUT_LINE_LENGTH].
+enum input_feedback inputReadRecord(struct InputReader *reader, size_t size,
+                                    const char **record);
+
+#endif
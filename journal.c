@@ -0,0 +1,387 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+// For fdatasync, fork and O_DIRECTORY.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "utils.h"
+
+#define JOURNAL_MAGIC "MJOURNAL"
+#define JOURNAL_CHECKPOINT_SUFFIX ".checkpoint"
+
+// Room for the longest suffix of a file name: a dot and a uint64 number, or
+// [JOURNAL_CHECKPOINT_SUFFIX], with the '\0'.
+#define JOURNAL_SUFFIX_SIZE (24)
+
+// Size of the buffer of records not written yet.
+#define JOURNAL_BUFFER_SIZE (1 << 16)
+
+// Copy of [length] characters of [text], ended with '\0'. Aborts with error
+// code 1 if could not allocate memory.
+static char *copyString(const char *text, size_t length) {
+  char *res = malloc(length + 1);
+  if (!res)
+    exit(1);
+
+  memcpy(res, text, length);
+  res[length] = '\0';
+  return res;
+}
+
+// Name of the file of the [segment], valid until the next name is made.
+static const char *segmentPath(struct Journal *journal, uint64_t segment) {
+  sprintf(journal->file_path, "%s.%llu", journal->path,
+          (unsigned long long)segment);
+  return journal->file_path;
+}
+
+// Name of the checkpoint file, valid until the next name is made.
+static const char *checkpointPath(struct Journal *journal) {
+  sprintf(journal->file_path, "%s" JOURNAL_CHECKPOINT_SUFFIX, journal->path);
+  return journal->file_path;
+}
+
+// Make the files created or renamed in the directory of the journal stay after
+// a crash. Returns 0 on failure.
+static int syncDirectory(struct Journal *journal) {
+  int fd = open(journal->directory, O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return 0;
+
+  int res = fsync(fd) == 0;
+  close(fd);
+  return res;
+}
+
+// Close the files and free the [journal].
+static void journalFree(struct Journal *journal) {
+  if (journal->fd >= 0)
+    close(journal->fd);
+
+  free(journal->path);
+  free(journal->file_path);
+  free(journal->directory);
+  free(journal->buffer);
+  free(journal);
+}
+
+// Create the file of the [segment] and append the next commands to it. Returns
+// 0 if it could not be created, the current segment is not changed then.
+static int journalCreateSegment(struct Journal *journal, uint64_t segment) {
+  int fd = open(segmentPath(journal, segment), O_WRONLY | O_CREAT | O_TRUNC,
+                0644);
+  if (fd < 0)
+    return 0;
+
+  struct JournalHeader header = {JOURNAL_MAGIC, segment};
+  if (!writeAll(fd, &header, sizeof(header)) || !syncDirectory(journal)) {
+    close(fd);
+    return 0;
+  }
+
+  if (journal->fd >= 0)
+    close(journal->fd);
+
+  journal->fd = fd;
+  journal->segment = segment;
+  journal->segment_size = sizeof(header);
+  journal->unsynced = 1;
+  return 1;
+}
+
+// Apply the [command] read from a segment to the [tree]. Returns 0 if it is not
+// a command that could have been journaled, the segment ends before it then.
+static int journalApply(struct Tree tree, const struct Command *command) {
+  const int32_t *args = command->args;
+  if (args[0] < 0 || args[1] < 0)
+    return 0;
+
+  switch (command->type) {
+  case COMMAND_ADD_USER:
+    treeAddNode(tree, args[1], args[0]);
+    return 1;
+  case COMMAND_DEL_USER:
+    treeDelNode(tree, args[0]);
+    return 1;
+  case COMMAND_ADD_MOVIE:
+    treeAddPreference(tree, args[0], args[1]);
+    return 1;
+  case COMMAND_DEL_MOVIE:
+    treeRemovePreference(tree, args[0], args[1]);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Apply the commands of the [segment], open as [fd], to the [tree]. Returns
+// the size of its valid part, 0 if even its header is not valid.
+static int64_t journalReplay(int fd, uint64_t segment, struct Tree tree) {
+  struct InputReader *input = inputCreate(fd);
+  int64_t size = 0;
+
+  const char *record;
+  struct JournalHeader header;
+  if (inputReadRecord(input, sizeof(header), &record) == INPUT_OK) {
+    memcpy(&header, record, sizeof(header));
+    if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) == 0 &&
+        header.segment == segment) {
+      size = sizeof(header);
+
+      struct Parser parser = {input, 1, 0};
+      struct Command command;
+      for (;;) {
+        parseCommand(&parser, &command);
+        if (!journalApply(tree, &command))
+          break;
+
+        size += COMMAND_RECORD_SIZE;
+      }
+    }
+  }
+
+  inputDestroy(input);
+  return size;
+}
+
+struct Journal *journalOpen(const char *path, int64_t limit, struct Tree tree) {
+  struct Journal *journal = malloc(sizeof(struct Journal));
+  if (!journal)
+    exit(1);
+
+  size_t length = strlen(path);
+  const char *slash = strrchr(path, '/');
+  journal->path = copyString(path, length);
+  journal->file_path = malloc(length + JOURNAL_SUFFIX_SIZE);
+  journal->directory = !slash ? copyString(".", 1)
+                              : copyString(path, MAX(slash - path, 1));
+  journal->buffer = malloc(JOURNAL_BUFFER_SIZE);
+  if (!journal->file_path || !journal->buffer)
+    exit(1);
+
+  journal->fd = -1;
+  journal->segment = journal->compactor_segment = 0;
+  journal->segment_size = 0;
+  journal->size = 0;
+  journal->unsynced = 0;
+  journal->limit = limit;
+  journal->compactor = 0;
+
+  uint64_t included = 0;
+  if (access(checkpointPath(journal), F_OK) == 0 &&
+      !treeLoad(tree, journal->file_path, &included)) {
+    journalFree(journal);
+    return NULL;
+  }
+
+  // Segments are removed from the oldest one, after a crash the ones left in
+  // the checkpoint end right before the first one that is not.
+  for (uint64_t segment = included;
+       segment > 0 && unlink(segmentPath(journal, segment)) == 0; --segment)
+    ;
+
+  journal->first_segment = included + 1;
+
+  int64_t size = 0;
+  for (uint64_t segment = included + 1;; ++segment) {
+    int fd = open(segmentPath(journal, segment), O_RDWR);
+    if (fd < 0 && errno == ENOENT)
+      break;
+    if (fd < 0) {
+      journalFree(journal);
+      return NULL;
+    }
+
+    size = journalReplay(fd, segment, tree);
+    if (journal->fd >= 0)
+      close(journal->fd);
+
+    journal->fd = fd;
+    journal->segment = segment;
+  }
+
+  // The last segment is cut after its last whole record. If there is none, or
+  // its header was not written, it is started again.
+  int ok;
+  if (journal->fd < 0)
+    ok = journalCreateSegment(journal, included + 1);
+  else if (size == 0)
+    ok = journalCreateSegment(journal, journal->segment);
+  else
+    ok = ftruncate(journal->fd, size) == 0 &&
+         lseek(journal->fd, size, SEEK_SET) == size;
+
+  if (!ok) {
+    journalFree(journal);
+    return NULL;
+  }
+
+  if (size > 0)
+    journal->segment_size = size;
+
+  return journal;
+}
+
+// Write the records from the buffer to the current segment. Aborts with error
+// code 1 on a write error.
+static void journalWrite(struct Journal *journal) {
+  if (!writeAll(journal->fd, journal->buffer, journal->size))
+    exit(1);
+
+  journal->size = 0;
+  journal->unsynced = 1;
+}
+
+// Remove all segments up to [last], they are in the checkpoint now.
+static void journalRemoveSegments(struct Journal *journal, uint64_t last) {
+  assert(last < journal->segment);
+  for (; journal->first_segment <= last; ++journal->first_segment)
+    unlink(segmentPath(journal, journal->first_segment));
+}
+
+// Check if the checkpoint being written is done, or wait for it if [block].
+// Its segments are removed if it was written.
+static void journalReap(struct Journal *journal, int block) {
+  assert(journal->compactor);
+
+  int status;
+  pid_t pid;
+  do {
+    pid = waitpid(journal->compactor, &status, block ? 0 : WNOHANG);
+  } while (pid < 0 && errno == EINTR);
+
+  if (pid == 0)
+    return;
+
+  // If the checkpoint failed, its segments are kept and included in the next
+  // one.
+  if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    journalRemoveSegments(journal, journal->compactor_segment);
+
+  journal->compactor = 0;
+}
+
+// Write the checkpoint of the [tree], which includes all segments up to
+// [included]. Returns 0 on failure, the old checkpoint is kept then.
+static int journalWriteCheckpoint(struct Journal *journal, struct Tree tree,
+                                  uint64_t included) {
+  return treeSave(tree, checkpointPath(journal), included) &&
+         syncDirectory(journal);
+}
+
+// Write the [tree] with the [writer] of the checkpoint, which includes all
+// segments up to [included]. Returns 0 on failure, the old checkpoint is kept
+// then. Nothing is allocated, see [journalCompact].
+static int journalCommitCheckpoint(struct Journal *journal, struct Tree tree,
+                                   struct SnapshotWriter *writer,
+                                   uint64_t included) {
+  treeWrite(tree, writer);
+  return snapshotWriterCommit(writer, included) && syncDirectory(journal);
+}
+
+// Start a new segment, and write the checkpoint of the [tree] with all the
+// previous ones in a child process. It has a copy of the tree at this moment,
+// so the commands can go on.
+//
+// The threads of the tree and of the read batch may be running, and the child
+// is only a copy of this one. A lock held by another thread, one inside malloc
+// too, would never be released there. So the file and its buffer are made
+// before the fork, and the child only writes them with write(2), fsync(2) and
+// rename(2), and leaves with _exit.
+static void journalCompact(struct Journal *journal, struct Tree tree) {
+  journalSync(journal);
+  uint64_t included = journal->segment;
+  if (!journalCreateSegment(journal, included + 1))
+    exit(1);
+
+  // If the checkpoint cannot be written, its segments are kept and included in
+  // the next one.
+  struct SnapshotWriter writer;
+  if (!snapshotWriterOpen(&writer, checkpointPath(journal)))
+    return;
+
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(journalCommitCheckpoint(journal, tree, &writer, included) ? 0 : 1);
+
+  if (pid < 0) {
+    // There is no child, the checkpoint is written right away.
+    if (journalCommitCheckpoint(journal, tree, &writer, included))
+      journalRemoveSegments(journal, included);
+
+    snapshotWriterFree(&writer);
+    return;
+  }
+
+  // The file is left to the child.
+  snapshotWriterFree(&writer);
+  journal->compactor = pid;
+  journal->compactor_segment = included;
+}
+
+void journalAppend(struct Journal *journal, struct Tree tree,
+                   const struct Command *command) {
+  if (JOURNAL_BUFFER_SIZE - journal->size < COMMAND_RECORD_SIZE)
+    journalWrite(journal);
+
+  commandEncode(command, journal->buffer + journal->size);
+  journal->size += COMMAND_RECORD_SIZE;
+  journal->segment_size += COMMAND_RECORD_SIZE;
+
+  // Only one checkpoint is written at a time, the segment grows until the
+  // previous one is done.
+  if (journal->segment_size >= journal->limit && !journal->compactor)
+    journalCompact(journal, tree);
+}
+
+void journalSync(struct Journal *journal) {
+  if (journal->size > 0)
+    journalWrite(journal);
+
+  if (journal->unsynced) {
+    if (fdatasync(journal->fd) != 0)
+      exit(1);
+
+    journal->unsynced = 0;
+  }
+
+  if (journal->compactor)
+    journalReap(journal, 0);
+}
+
+void journalCheckpoint(struct Journal *journal, struct Tree tree) {
+  if (journal->compactor)
+    journalReap(journal, 1);
+
+  journalSync(journal);
+  uint64_t included = journal->segment;
+  if (!journalCreateSegment(journal, included + 1) ||
+      !journalWriteCheckpoint(journal, tree, included))
+    exit(1);
+
+  journalRemoveSegments(journal, included);
+}
+
+void journalClose(struct Journal *journal) {
+  if (journal->compactor)
+    journalReap(journal, 1);
+
+  journalSync(journal);
+  journalFree(journal);
+}
@@ -0,0 +1,96 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "command.h"
+#include "tree.h"
+
+// Default size of a journal segment after which it is folded into a new
+// checkpoint, can be changed with the --journal-limit option.
+#define JOURNAL_DEFAULT_LIMIT (64 << 20)
+
+// Write-ahead journal of the commands that changed the tree. For a journal at
+// [path] there are these files:
+//   [path].checkpoint - snapshot of the tree, its sequence number is the last
+//                       segment it includes,
+//   [path].N          - segments with the commands done after the previous
+//                       ones, for N = 1, 2, ... Every segment is a
+//                       [JournalHeader] followed by binary command records.
+// The tree is the checkpoint with the commands of all later segments applied.
+// When the current segment gets over the limit, a new one is started and a
+// child process writes the checkpoint of the tree at that moment, so the
+// segments it includes can be removed. Other threads may be running then, so
+// the child does not allocate memory: everything it needs is made before the
+// fork.
+struct Journal {
+  char *path;
+
+  // Buffer for the names of the files, long enough for all of them.
+  char *file_path;
+
+  // Directory of the files, synced when a file is created or renamed.
+  char *directory;
+
+  // Current segment, commands are appended to it.
+  int fd;
+  uint64_t segment;
+  int64_t segment_size;
+
+  // Lowest segment that may still exist, all before it are in the checkpoint.
+  uint64_t first_segment;
+
+  // Records not written to [fd] yet.
+  char *buffer;
+  size_t size;
+
+  // 1 if some records were written to [fd] but not synced.
+  int unsynced;
+
+  int64_t limit;
+
+  // Child process writing a checkpoint with all segments up to
+  // [compactor_segment], 0 if there is none.
+  pid_t compactor;
+  uint64_t compactor_segment;
+};
+
+// Start of every segment file.
+struct JournalHeader {
+  char magic[8];
+  uint64_t segment;
+};
+
+// Open the journal at [path] and bring the [tree], which must be empty, to the
+// state it records: load the checkpoint and apply the commands of the later
+// segments. A record cut by a crash ends the last segment. Segments get over
+// [limit] bytes before they are folded. Returns NULL if the checkpoint is not
+// valid or the files could not be created. Aborts with error code 1 if could
+// not allocate memory.
+struct Journal *journalOpen(const char *path, int64_t limit, struct Tree tree);
+
+// Wait for the checkpoint being written, sync the journal and free it. Aborts
+// with error code 1 if the journal could not be written.
+void journalClose(struct Journal *journal);
+
+// Append the [command], which has just changed the [tree]. It is on the disk
+// after the next [journalSync]. Aborts with error code 1 if could not allocate
+// memory or the journal could not be written.
+void journalAppend(struct Journal *journal, struct Tree tree,
+                   const struct Command *command);
+
+// Write and sync all commands appended so far. Commands appended between two
+// syncs are synced at once. Aborts with error code 1 if the journal could not
+// be written.
+void journalSync(struct Journal *journal);
+
+// Write the checkpoint of the whole [tree] now and remove all segments, used
+// after the tree was replaced. Aborts with error code 1 if could not allocate
+// memory or the checkpoint could not be written.
+void journalCheckpoint(struct Journal *journal, struct Tree tree);
+
+#endif
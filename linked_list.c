@@ -34,6 +34,13 @@ static void listPushBackNode(struct List *list,
   }
 }
 
+struct List *listCreate(struct SlabAllocator *alloc) {
+  struct List *res = slabAlloc(alloc, SLAB_LIST);
+  (*res) = (struct List){NULL, NULL};
+
+  return res;
+}
+
 int listEmpty(const struct List *list) {
   if (!list->head)
     assert(!list->tail);
@@ -51,23 +58,19 @@ void listPrintContent(const struct List *list) {
   });
 }
 
-void listFree(struct List *list) {
+void listFree(struct SlabAllocator *alloc, struct List *list) {
   if (!list)
     assert(!"List pointer cannot be NULL!");
 
-  listForeach(list, curr, { free(curr); });
+  listForeach(list, curr, { slabFree(alloc, SLAB_LIST_NODE, curr); });
 
-  free(list);
+  slabFree(alloc, SLAB_LIST, list);
   list = NULL;
 }
 
-void listPushBack(struct List *list, int32_t inserted_value) {
-  struct ListNode *new_node = malloc(sizeof(struct ListNode));
-
-  // Could not allocate memory.
-  if (!new_node)
-    exit(1);
-
+void listPushBack(struct SlabAllocator *alloc, struct List *list,
+                  int32_t inserted_value) {
+  struct ListNode *new_node = slabAlloc(alloc, SLAB_LIST_NODE);
   new_node->value = inserted_value;
   listPushBackNode(list, new_node);
 }
@@ -91,7 +94,8 @@ void listConcat(struct List *dest, struct List *src) {
   src->tail = NULL;
 }
 
-int listInsertMaintainSortOrder(struct List *list, int32_t value) {
+int listInsertMaintainSortOrder(struct SlabAllocator *alloc, struct List *list,
+                                int32_t value) {
 #ifdef DEBUG
   assert(listIsSorted(list));
 #endif
@@ -99,10 +103,7 @@ int listInsertMaintainSortOrder(struct List *list, int32_t value) {
   if (!list)
     assert(!"List pointer cannot be NULL!");
 
-  struct ListNode *new_node = malloc(sizeof(struct ListNode));
-  if (!new_node)
-    exit(1);
-
+  struct ListNode *new_node = slabAlloc(alloc, SLAB_LIST_NODE);
   (*new_node) = (struct ListNode){NULL, NULL, value};
 
   int value_inserted = 0, value_already_in_list = 0;
@@ -139,13 +140,14 @@ int listInsertMaintainSortOrder(struct List *list, int32_t value) {
     listPushBackNode(list, new_node);
     value_inserted = 1;
   } else if (!value_inserted && value_already_in_list) {
-    free(new_node);
+    slabFree(alloc, SLAB_LIST_NODE, new_node);
   }
 
   return value_inserted;
 }
 
-void listRemoveNode(struct List *list, struct ListNode *el) {
+void listRemoveNode(struct SlabAllocator *alloc, struct List *list,
+                    struct ListNode *el) {
   // If this is the only element in the list:
   if (!el->prev && !el->next) {
     list->head = NULL;
@@ -165,10 +167,11 @@ void listRemoveNode(struct List *list, struct ListNode *el) {
     el->next->prev = el->prev;
   }
 
-  free(el);
+  slabFree(alloc, SLAB_LIST_NODE, el);
 }
 
-int listRemoveElement(struct List *list, int32_t value_to_remove) {
+int listRemoveElement(struct SlabAllocator *alloc, struct List *list,
+                      int32_t value_to_remove) {
   if (!list)
     assert(!"List pointer cannot be NULL!");
 
@@ -181,7 +184,7 @@ int listRemoveElement(struct List *list, int32_t value_to_remove) {
       assert(current == list->tail);
 
     if (current->value == value_to_remove) {
-      listRemoveNode(list, current);
+      listRemoveNode(alloc, list, current);
       has_removed_element = 1;
     }
 
@@ -191,16 +194,15 @@ int listRemoveElement(struct List *list, int32_t value_to_remove) {
   return has_removed_element;
 }
 
-struct List *listMergeSortedLists(struct List *self, struct List *other,
+struct List *listMergeSortedLists(struct SlabAllocator *alloc,
+                                  struct List *self, struct List *other,
                                   int32_t greater_than, int32_t max_elements) {
 #ifdef DEBUG
   assert(listIsSorted(self));
   assert(listIsSorted(other));
 #endif
 
-  struct List *res = malloc(sizeof(struct List));
-  (*res) = (struct List){NULL, NULL};
-
+  struct List *res = listCreate(alloc);
   struct ListNode *self_curr = self->head, *other_curr = other->head;
 
   int inserted_elements = 0;
@@ -214,7 +216,7 @@ struct List *listMergeSortedLists(struct List *self, struct List *other,
 
     if (other_curr && self_curr->value == other_curr->value) {
       struct ListNode *next = other_curr->next;
-      free(other_curr);
+      slabFree(alloc, SLAB_LIST_NODE, other_curr);
       other_curr = next;
       continue;
     }
@@ -235,14 +237,14 @@ struct List *listMergeSortedLists(struct List *self, struct List *other,
   for (int i = 0; i < 2; ++i) {
     while (self_curr) {
       struct ListNode *next = self_curr->next;
-      free(self_curr);
+      slabFree(alloc, SLAB_LIST_NODE, self_curr);
       self_curr = next;
     }
     SWAP(self_curr, other_curr);
   }
 
-  free(self);
-  free(other);
+  slabFree(alloc, SLAB_LIST, self);
+  slabFree(alloc, SLAB_LIST, other);
   self = NULL;
   other = NULL;
 
@@ -6,6 +6,11 @@
 
 #include <stdint.h>
 
+#include "slab.h"
+
+// All functions that allocate or free nodes take the allocator that owns the
+// list. Nodes come from its [SLAB_LIST_NODE] class, lists from [SLAB_LIST].
+
 struct ListNode {
   struct ListNode *next, *prev;
 
@@ -22,6 +27,10 @@ struct List {
   struct ListNode *tail;
 };
 
+// Allocate an empty list. Aborts with error code 1 if could not allocate
+// memory.
+struct List *listCreate(struct SlabAllocator *alloc);
+
 // 1 if [list] is empty, else 0.
 int listEmpty(const struct List *list);
 
@@ -29,12 +38,13 @@ int listEmpty(const struct List *list);
 void listPrintContent(const struct List *list);
 
 // Free whole [list] (and its conents, of course).
-void listFree(struct List *list);
+void listFree(struct SlabAllocator *alloc, struct List *list);
 
 // Push the given value to the end of a list. Allocates a new node and uses
 // [listPushBackNode] to add it to the list. Aborts with error code 1 if
 // could not allocate memeory.
-void listPushBack(struct List *list, int32_t inserted_value);
+void listPushBack(struct SlabAllocator *alloc, struct List *list,
+                  int32_t inserted_value);
 
 // "Copy" the content of the [src] list to the [dest]. [dest] list becomes
 // empty, and all its elements are moved to [dest]. No additional memory is
@@ -45,20 +55,24 @@ void listConcat(struct List *dest, struct List *src);
 // is already there. This assumes list is sorted in NON-INCREASING order!
 // Aborts with error code 1 if could not allocate memory.
 // Returns 0 if value wasn't inserted, else 1.
-int listInsertMaintainSortOrder(struct List *list, int32_t value);
+int listInsertMaintainSortOrder(struct SlabAllocator *alloc, struct List *list,
+                                int32_t value);
 
 // Removes the node [el] from the list. This assmues that [el] is part of
 // [list]. If it is not true, behaviour is undefined!
-void listRemoveNode(struct List *list, struct ListNode *el);
+void listRemoveNode(struct SlabAllocator *alloc, struct List *list,
+                    struct ListNode *el);
 
 // Removes ALL ocurrences of [value_to_remove] from the [list].
-int listRemoveElement(struct List *list, int32_t value_to_remove);
+int listRemoveElement(struct SlabAllocator *alloc, struct List *list,
+                      int32_t value_to_remove);
 
 // Merge two sorted lists, but keep only [max_elements] or less elements and
 // store values only grater than [greater_than]. Both [self], and [other] lists
 // are deleted and cleared, nodes that are not in the result list are freed. No
 // additional memory for nodes in the result list is allocated.
-struct List *listMergeSortedLists(struct List *self, struct List *other,
+struct List *listMergeSortedLists(struct SlabAllocator *alloc,
+                                  struct List *self, struct List *other,
                                   int32_t greater_than, int32_t max_elements);
 
 // Macro used to execute some code for each node in a list.
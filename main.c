@@ -11,221 +11,750 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#include "linked_list.h"
+#include <string.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "input.h"
+#include "journal.h"
+#include "output.h"
+#include "read_batch.h"
+#include "ring.h"
 #include "tree.h"
 #include "utils.h"
+#include "work_pool.h"
 
-// Max size of a VALID input line.
-#define MAX_INPUT_LINE_LENGTH (32)
+#if MARATHON_PARALLEL
+#include <pthread.h>
+#endif
 
-const int32_t MAX_USERS = 65535;
+// Default limit of user ids, can be changed with the --max-users option.
+const int32_t DEFAULT_MAX_USERS = 65535;
 const int32_t MAX_MOVIE_RATING = 2147483647;
 const int32_t MAX_K = 2147483647;
 
-// Return values of readInputLine function:
-enum input_feedback {
-  INPUT_EOF,
-  INPUT_IGNORED_LINE,
-  INPUT_INVALID,
-  INPUT_INVALID_AND_EOF,
-  INPUT_OK
+// Greatest valid user id.
+static int32_t max_users;
+
+// Number of threads, set with the --threads option.
+static int32_t thread_count;
+
+// 1 if parsing, execution and output run on separate threads, set with the
+// --pipeline option. Single-threaded and debug builds ignore it, and so does
+// the journal.
+static int pipeline_mode;
+
+// 1 if the commands are binary records, set with the --binary-input option.
+static int binary_input;
+
+// 1 if the results are written as binary words, set with the --binary-output
+// option.
+static int binary_output;
+
+// Set with the --convert option, the input is then rewritten in another format
+// and not executed.
+enum convert_mode {
+  CONVERT_NONE,
+  // Text commands to binary records.
+  CONVERT_COMMANDS_TO_BINARY,
+  // Binary records to text commands.
+  CONVERT_COMMANDS_TO_TEXT,
+  // Binary results to the text output.
+  CONVERT_RESULTS_TO_TEXT
+};
+
+static enum convert_mode convert_mode;
+
+// Snapshot loaded at the start, set with the --load option. NULL if none.
+static const char *load_path;
+
+// Journal of the changes of the tree, set with the --journal option, and the
+// size of its segments set with --journal-limit. The commands run on a single
+// thread then, without the pipeline. NULL if there is none.
+static const char *journal_path;
+static int32_t journal_limit;
+static struct Journal *journal;
+
+#if MARATHON_PARALLEL
+// Marathons running on other threads while the commands go on, NULL if they
+// run one by one.
+static struct ReadBatch *marathon_batch;
+#endif
+
+// Results are passed to [formatResult] as a stream of words. Values of a
+// marathon are non-negative, so they cannot be mistaken for these codes. The
+// binary output is this stream, every word as 4 bytes with the lowest first,
+// without [RESULT_END].
+enum result_code {
+  RESULT_OK = -1,
+  RESULT_ERROR = -2,
+  // Values of a marathon follow, up to [RESULT_VALUES_END].
+  RESULT_VALUES = -3,
+  // The next word is a user id, then its values up to [RESULT_VALUES_END].
+  RESULT_USER_VALUES = -4,
+  RESULT_VALUES_END = -5,
+  // Nothing more will be printed.
+  RESULT_END = -6,
+  // Place of the result of a marathon that is still running. It is only held,
+  // see [ResultSink], and never formatted.
+  RESULT_PENDING = -7
+};
+
+// Turns the result words into the output text.
+struct Formatter {
+  struct Output *out;
+
+  // 1 if the words are written as they are, in the binary output.
+  int binary;
+
+  // Values printed in the current line.
+  int32_t printed;
+
+  // 1 if the current line is a result of the marathonAll, "id: values".
+  int user_line;
+
+  // 1 if the next word is the user id of such a line.
+  int expect_user;
+};
+
+static void formatResult(struct Formatter *format, int32_t word) {
+  struct Output *out = format->out;
+  if (format->binary) {
+    if (word != RESULT_END)
+      outputBinaryInt32(out, OUTPUT_STDOUT, word);
+
+    return;
+  }
+
+  if (format->expect_user) {
+    outputInt32(out, OUTPUT_STDOUT, word);
+    outputLiteral(out, OUTPUT_STDOUT, ":");
+    format->expect_user = 0;
+    return;
+  }
+
+  if (word >= 0) {
+    // Dont print space before first number, unless after the user id.
+    if (format->printed > 0 || format->user_line)
+      outputLiteral(out, OUTPUT_STDOUT, " ");
+
+    outputInt32(out, OUTPUT_STDOUT, word);
+    ++format->printed;
+    return;
+  }
+
+  switch (word) {
+  case RESULT_OK:
+    outputLiteral(out, OUTPUT_STDOUT, "OK\n");
+    break;
+  case RESULT_ERROR:
+    outputLiteral(out, OUTPUT_STDERR, "ERROR\n");
+    break;
+  case RESULT_VALUES:
+  case RESULT_USER_VALUES:
+    format->printed = 0;
+    format->user_line = word == RESULT_USER_VALUES;
+    format->expect_user = format->user_line;
+    break;
+  case RESULT_VALUES_END:
+    if (format->printed == 0) {
+      if (format->user_line)
+        outputLiteral(out, OUTPUT_STDOUT, " NONE");
+      else
+        outputLiteral(out, OUTPUT_STDOUT, "NONE");
+    }
+
+    outputLiteral(out, OUTPUT_STDOUT, "\n");
+    break;
+  default:
+    assert(word == RESULT_END);
+  }
+}
+
+// Where the results of the commands go. In the serial mode they are formatted
+// right away, in the pipeline mode they are passed to the formatting thread.
+struct ResultSink {
+  // NULL in the serial mode.
+  struct Ring *ring;
+  struct Formatter format;
+
+  // Words that wait for the marathons running before them, in order, with
+  // [RESULT_PENDING] in place of the result of every such marathon. The first
+  // one is always [RESULT_PENDING].
+  int32_t *held;
+  int64_t held_begin, held_end, held_capacity;
 };
 
-static void printError() { fprintf(stderr, "ERROR\n"); }
+// Words held behind the running marathons, more of them wait until the
+// marathons are done.
+#define MAX_HELD_RESULTS (1 << 20)
 
-static void addUser(struct Tree tree, int parentUserId, int userId) {
-  if (!inRange(0, MAX_USERS, parentUserId) || !inRange(0, MAX_USERS, userId) ||
-      !treeAddNode(tree, userId, parentUserId))
-    printError();
+static void sendResult(struct ResultSink *sink, int32_t word) {
+  if (sink->ring)
+    ringPush(sink->ring, word);
   else
-    printf("OK\n");
+    formatResult(&sink->format, word);
 }
 
-static void delUser(struct Tree tree, int userId) {
-  if (!inRange(0, MAX_USERS, userId) || !treeDelNode(tree, userId))
-    printError();
+// Put the [word] after the held ones. Aborts with error code 1 if could not
+// allocate memory.
+static void holdResult(struct ResultSink *sink, int32_t word) {
+  if (sink->held_end == sink->held_capacity && sink->held_begin > 0) {
+    memmove(sink->held, sink->held + sink->held_begin,
+            sizeof(int32_t) * (sink->held_end - sink->held_begin));
+    sink->held_end -= sink->held_begin;
+    sink->held_begin = 0;
+  } else if (sink->held_end == sink->held_capacity) {
+    int64_t new_capacity = MAX(2 * sink->held_capacity, 1024);
+    int32_t *held = realloc(sink->held, sizeof(int32_t) * new_capacity);
+    if (!held)
+      exit(1);
+
+    sink->held = held;
+    sink->held_capacity = new_capacity;
+  }
+
+  sink->held[sink->held_end++] = word;
+}
+
+static void emitResult(struct ResultSink *sink, int32_t word) {
+  if (sink->held_end > 0)
+    holdResult(sink, word);
   else
-    printf("OK\n");
+    sendResult(sink, word);
 }
 
-static void addMovie(struct Tree tree, int userId, int32_t movieRating) {
-  if (!inRange(0, MAX_USERS, userId) ||
-      !inRange(0, MAX_MOVIE_RATING, movieRating) ||
-      !treeAddPreference(tree, userId, movieRating))
-    printError();
+// Make everything emitted so far visible to the user.
+static void flushResults(struct ResultSink *sink) {
+  if (sink->ring)
+    ringPublish(sink->ring);
   else
-    printf("OK\n");
+    outputFlush(sink->format.out);
 }
 
-static void delMovie(struct Tree tree, int userId, int32_t movieRating) {
-  if (!inRange(0, MAX_USERS, userId) ||
-      !inRange(0, MAX_MOVIE_RATING, movieRating) ||
-      !treeRemovePreference(tree, userId, movieRating))
-    printError();
+static void printError(struct ResultSink *sink) {
+  emitResult(sink, RESULT_ERROR);
+}
+
+static void printOk(struct ResultSink *sink) { emitResult(sink, RESULT_OK); }
+
+#if MARATHON_PARALLEL
+
+// Used as [emit] of [batchTake]. The result takes the place of the first held
+// [RESULT_PENDING], and the words after it wait only for the next one.
+static void printBatchResult(void *context, const int32_t *values,
+                             int32_t size) {
+  struct ResultSink *sink = context;
+  assert(sink->held[sink->held_begin] == RESULT_PENDING);
+  sink->held_begin++;
+
+  sendResult(sink, RESULT_VALUES);
+  for (int32_t i = 0; i < size; ++i)
+    sendResult(sink, values[i]);
+
+  sendResult(sink, RESULT_VALUES_END);
+
+  while (sink->held_begin < sink->held_end &&
+         sink->held[sink->held_begin] != RESULT_PENDING)
+    sendResult(sink, sink->held[sink->held_begin++]);
+
+  if (sink->held_begin == sink->held_end)
+    sink->held_begin = sink->held_end = 0;
+}
+
+#endif
+
+// Print the results of the marathons that are done, and the words held behind
+// them. If [wait], waits for all the marathons.
+static void takeResults(struct ResultSink *sink, struct Tree tree, int wait) {
+#if MARATHON_PARALLEL
+  if (marathon_batch && batchPending(marathon_batch))
+    batchTake(marathon_batch, tree, wait, printBatchResult, sink);
+#else
+  (void)sink;
+  (void)tree;
+  (void)wait;
+#endif
+}
+
+// Context of [beforeWait].
+struct WaitContext {
+  struct ResultSink *sink;
+  struct Tree tree;
+};
+
+// Used before the commands thread may block waiting for more commands. Nothing
+// should wait in the buffers then.
+static void beforeWait(void *context) {
+  struct WaitContext *wait = context;
+  takeResults(wait->sink, wait->tree, 1);
+  flushResults(wait->sink);
+}
+
+// Print the result of a command that changes the tree. Returns [success].
+static int printChange(struct ResultSink *sink, int success) {
+  if (success)
+    printOk(sink);
   else
-    printf("OK\n");
+    printError(sink);
+
+  return success;
+}
+
+// The commands that change the tree return 1 if they did.
+
+static int addUser(struct ResultSink *sink, struct Tree tree, int parentUserId,
+                   int userId) {
+  return printChange(sink, inRange(0, max_users, parentUserId) &&
+                               inRange(0, max_users, userId) &&
+                               treeAddNode(tree, userId, parentUserId));
+}
+
+static int delUser(struct ResultSink *sink, struct Tree tree, int userId) {
+  return printChange(sink, inRange(0, max_users, userId) &&
+                               treeDelNode(tree, userId));
+}
+
+static int addMovie(struct ResultSink *sink, struct Tree tree, int userId,
+                    int32_t movieRating) {
+  return printChange(sink, inRange(0, max_users, userId) &&
+                               inRange(0, MAX_MOVIE_RATING, movieRating) &&
+                               treeAddPreference(tree, userId, movieRating));
+}
+
+static int delMovie(struct ResultSink *sink, struct Tree tree, int userId,
+                    int32_t movieRating) {
+  return printChange(sink, inRange(0, max_users, userId) &&
+                               inRange(0, MAX_MOVIE_RATING, movieRating) &&
+                               treeRemovePreference(tree, userId, movieRating));
 }
 
-static void marathon(struct Tree tree, int userId, int32_t k) {
-  if (!inRange(0, MAX_USERS, userId) || !inRange(0, MAX_K, k)) {
-    printError();
+static void marathon(struct ResultSink *sink, struct Tree tree, int userId,
+                     int32_t k) {
+  if (!inRange(0, max_users, userId) || !inRange(0, MAX_K, k)) {
+    printError(sink);
     return;
   }
 
+#if MARATHON_PARALLEL
+  // The marathon runs on another thread, the next commands do not wait for
+  // it. Its result is held in its place in the output.
+  if (marathon_batch) {
+    if (batchFull(marathon_batch))
+      takeResults(sink, tree, 1);
+
+    if (batchAdd(marathon_batch, tree, userId, k))
+      holdResult(sink, RESULT_PENDING);
+    else
+      printError(sink);
+
+    return;
+  }
+#endif
+
 #ifdef DEBUG
+  // The tree is printed with stdio, behind the buffered output. There is no
+  // pipeline in debug builds, so the output belongs to this thread.
+  outputFlush(sink->format.out);
   printf("Marathon on tree:\n");
   printTree(tree);
+  fflush(stdout);
 #endif
 
-  struct List *res = runMarathon(tree, userId, k);
+  struct MarathonIter *iter = marathonIterBegin(tree, userId, k);
+  if (!iter) {
+    printError(sink);
+    return;
+  }
 
-  if (!res) {
-    printError();
-  } else {
-    if (listEmpty(res))
-      printf("NONE\n");
-    else {
-      listPrintContent(res);
-      printf("\n");
-    }
+  // Values are printed as they are found, only the needed ones are looked for.
+  emitResult(sink, RESULT_VALUES);
+  int32_t printed = 0;
+  int32_t value;
+  while (printed < k && (value = marathonIterNext(iter)) != MARATHON_ITER_DONE) {
+    emitResult(sink, value);
+    ++printed;
+  }
+
+  emitResult(sink, RESULT_VALUES_END);
+  marathonIterEnd(iter);
+}
+
+// Used as [emit] of [runMarathonAll], prints a line "id: values".
+static void printUserResult(void *sink, int id, const int32_t *values,
+                            int32_t size) {
+  emitResult(sink, RESULT_USER_VALUES);
+  emitResult(sink, id);
+  for (int32_t i = 0; i < size; ++i)
+    emitResult(sink, values[i]);
 
-    listFree(res);
+  emitResult(sink, RESULT_VALUES_END);
+}
+
+static void marathonAll(struct ResultSink *sink, struct Tree tree, int32_t k) {
+  if (!inRange(0, MAX_K, k)) {
+    printError(sink);
+    return;
   }
+
+  runMarathonAll(tree, k, printUserResult, sink);
 }
 
-static enum input_feedback readInputLine(char *buffer) {
-  char c;
-  int index_in_buffer = 0;
+static void executeCommand(struct ResultSink *sink, struct Tree tree,
+                           const struct Command *command) {
+  const int32_t *args = command->args;
+  int changed = 0;
+  switch (command->type) {
+  case COMMAND_ADD_USER:
+    changed = addUser(sink, tree, args[0], args[1]);
+    break;
+  case COMMAND_DEL_USER:
+    changed = delUser(sink, tree, args[0]);
+    break;
+  case COMMAND_ADD_MOVIE:
+    changed = addMovie(sink, tree, args[0], args[1]);
+    break;
+  case COMMAND_DEL_MOVIE:
+    changed = delMovie(sink, tree, args[0], args[1]);
+    break;
+  case COMMAND_MARATHON:
+    marathon(sink, tree, args[0], args[1]);
+    break;
+  case COMMAND_MARATHON_ALL:
+    marathonAll(sink, tree, args[0]);
+    break;
+  case COMMAND_COMPACT:
+    treeCompact(tree);
+    printOk(sink);
+    break;
+  case COMMAND_SAVE:
+    if (treeSave(tree, command->path, 0))
+      printOk(sink);
+    else
+      printError(sink);
+    break;
+  case COMMAND_LOAD:
+    // The running marathons read the old tree. The journal starts again from
+    // the loaded one.
+    takeResults(sink, tree, 1);
+    if (printChange(sink, treeLoad(tree, command->path, NULL)) && journal)
+      journalCheckpoint(journal, tree);
+    break;
+  case COMMAND_INVALID:
+    printError(sink);
+    break;
+  case COMMAND_END:
+    takeResults(sink, tree, 1);
+    break;
+  }
+
+  // The result is not shown before the record is synced, see [syncJournal].
+  if (changed && journal)
+    journalAppend(journal, tree, command);
+
+  takeResults(sink, tree, sink->held_end - sink->held_begin > MAX_HELD_RESULTS);
+}
+
+// Used as [before_flush] of the output. The results of the commands are
+// printed only after their records, so the journal is synced once for all the
+// commands printed at a time.
+static void syncJournal(void *context) { journalSync(context); }
+
+// Parse, execute and print every command on this thread.
+static void runSerial(struct InputReader *input, struct Output *out,
+                      struct Tree tree) {
+  struct ResultSink sink = {NULL, {out, binary_output, 0, 0, 0}, NULL, 0, 0, 0};
+  struct WaitContext wait = {&sink, tree};
+  input->before_read = beforeWait;
+  input->before_read_context = &wait;
+  if (journal) {
+    out->before_flush = syncJournal;
+    out->before_flush_context = journal;
+  }
+
+  struct Parser parser = {input, binary_input, 0};
+  struct Command command;
+  do {
+    parseCommand(&parser, &command);
+    executeCommand(&sink, tree, &command);
+  } while (command.type != COMMAND_END);
+
+  free(sink.held);
+}
 
-  switch (c = getchar()) {
-    case EOF:
-      return INPUT_EOF;
+// Debug builds print the tree while executing, so there is no pipeline.
+#if MARATHON_PARALLEL && !defined(DEBUG)
 
-    case '\n':
-      return INPUT_IGNORED_LINE;
+// Sizes of the rings between the threads, as a power of two.
+#define PIPELINE_COMMANDS_LOG (14)
+#define PIPELINE_RESULTS_LOG (16)
 
-    // If given line is a comment, just skip to the EOL.
-    case '#': {
-      while ((c = getchar()) != '\n') {
-        if (c == EOF)
-          // In the task description in stands, that every proper input line is
-          // terminated with '\n', I treat this as an error.
-          return INPUT_INVALID_AND_EOF;
-      }
+struct Pipeline {
+  struct Parser parser;
+  struct Ring *commands;
+  struct Ring *results;
+  struct Formatter format;
+};
 
-      return INPUT_IGNORED_LINE;
+// Used as [before_read] of the input, so the commands thread does not wait
+// for commands that were read already.
+static void publishCommands(void *commands) { ringPublish(commands); }
+
+// Used as [before_wait] of the results, the formatting thread may sleep now.
+static void flushOutput(void *out) { outputFlush(out); }
+
+// A command goes through the ring as its type and two arguments. Save and
+// load are followed by their path, 4 characters in a word.
+static void pushCommand(struct Ring *commands, const struct Command *command) {
+  ringPush(commands, command->type);
+  ringPush(commands, command->args[0]);
+  ringPush(commands, command->args[1]);
+  if (command->type == COMMAND_SAVE || command->type == COMMAND_LOAD) {
+    for (int32_t i = 0; i < command->args[0]; i += sizeof(int32_t)) {
+      int32_t word;
+      memcpy(&word, command->path + i, sizeof(word));
+      ringPush(commands, word);
     }
+  }
+}
 
-    default: {
-      // Don't forget about the first character (getchar in switch statement).
-      do {
-        // Lines must end with '\n' so the input is invalid!
-        if (c == EOF)
-          return INPUT_INVALID_AND_EOF;
-
-        if (index_in_buffer >= MAX_INPUT_LINE_LENGTH)
-          break;
-
-        buffer[index_in_buffer++] = c;
-      } while ((c = getchar()) != '\n');
-
-      // [MAX_INPUT_LINE_LENGTH] is large enough to store any vaild input so the
-      // inserted line IS NOT valid. NOTE: Trailing zeors are not supported!
-      if (c != '\n') {
-        // Skip to the end of the line and return an input error.
-        while ((c = getchar()) != '\n')
-          if (c == EOF)
-            return INPUT_INVALID_AND_EOF;
-
-        return INPUT_INVALID;
-      }
-      buffer[index_in_buffer] = '\0';
-
-      // For tricky case when there is a nullbyte in the middle of the input.
-      for (int i = 0; i < index_in_buffer; ++i)
-        if (buffer[i] == '\0')
-          return INPUT_INVALID;
-
-      return INPUT_OK;
+static void popCommand(struct Ring *commands, struct Command *command) {
+  command->type = ringPop(commands);
+  command->args[0] = ringPop(commands);
+  command->args[1] = ringPop(commands);
+  if (command->type == COMMAND_SAVE || command->type == COMMAND_LOAD) {
+    for (int32_t i = 0; i < command->args[0]; i += sizeof(int32_t)) {
+      int32_t word = ringPop(commands);
+      memcpy(command->path + i, &word, sizeof(word));
     }
+
+    command->path[command->args[0]] = '\0';
   }
 }
 
-int main(void) {
-  struct Tree tree = initTree(MAX_USERS + 1);
-  enum input_feedback read_line_state = 0;
+static void *parserThread(void *context) {
+  struct Pipeline *pipeline = context;
+  struct Command command;
+  do {
+    parseCommand(&pipeline->parser, &command);
+    pushCommand(pipeline->commands, &command);
+  } while (command.type != COMMAND_END);
+
+  ringPublish(pipeline->commands);
+  return NULL;
+}
 
-  // [MAX_INPUT_LINE_LENGTH] characters is more than enought for valid,
-  // non-comment input lines. Comment lines are ignored, never stored in buffer.
-  static char input_buffer[MAX_INPUT_LINE_LENGTH];
+static void *formatterThread(void *context) {
+  struct Pipeline *pipeline = context;
+  int32_t word;
+  while ((word = ringPop(pipeline->results)) != RESULT_END)
+    formatResult(&pipeline->format, word);
 
-  while ((read_line_state = readInputLine(input_buffer)) != INPUT_EOF) {
-    if (read_line_state == INPUT_INVALID) {
-      // ERROR: Invalid input.
-      printError();
-      continue;
-    } else if (read_line_state == INPUT_IGNORED_LINE) {
-      continue;
-    }
-    // The case when input line is invalid (E.g. not ended with a '\n') and
-    // the EOF is found at the end of it.
-    else if (read_line_state == INPUT_INVALID_AND_EOF) {
-      printError();
-      break;
-    } else if (read_line_state == INPUT_OK) {
-      int idx_in_buffer = 0;
-      while (inRange('A', 'Z', input_buffer[idx_in_buffer]) ||
-             inRange('a', 'z', input_buffer[idx_in_buffer])) {
-        ++idx_in_buffer;
-      }
-
-      if (input_buffer[idx_in_buffer++] != ' ') {
-        // ERROR: Wrong input format; no space after a command.
-        printError();
-        continue;
-      }
-
-      // Arguments for currently called command. None command takes > 2.
-      int32_t args[2];
-
-      // Now we call a command based on what stands at the beginning of
-      // the input buffer.
-      if (prefixMatch(input_buffer, "addUser ")) {
-        if (!readNumbersFromBuffer(input_buffer + idx_in_buffer, 2, args))
-          printError();
-        else
-          addUser(tree, args[0], args[1]);
-      } else if (prefixMatch(input_buffer, "delUser ")) {
-        if (!readNumbersFromBuffer(input_buffer + idx_in_buffer, 1, args))
-          printError();
-        else
-          delUser(tree, args[0]);
-      } else if (prefixMatch(input_buffer, "addMovie ")) {
-        if (!readNumbersFromBuffer(input_buffer + idx_in_buffer, 2, args))
-          printError();
-        else
-          addMovie(tree, args[0], args[1]);
-      } else if (prefixMatch(input_buffer, "delMovie ")) {
-        if (!readNumbersFromBuffer(input_buffer + idx_in_buffer, 2, args))
-          printError();
-        else
-          delMovie(tree, args[0], args[1]);
-      } else if (prefixMatch(input_buffer, "marathon ")) {
-        if (!readNumbersFromBuffer(input_buffer + idx_in_buffer, 2, args))
-          printError();
-        else
-          marathon(tree, args[0], args[1]);
-      } else {
-        // ERROR: Unrecognized opeartion.
-        printError();
-        continue;
-      }
+  outputFlush(pipeline->format.out);
+  return NULL;
+}
+
+// Parse the input, execute the commands and format the output on three
+// threads. The output is the same as of [runSerial]. Aborts with error code 1
+// if could not allocate memory or start a thread.
+static void runPipeline(struct InputReader *input, struct Output *out,
+                        struct Tree tree) {
+  struct Pipeline pipeline = {{input, binary_input, 0},
+                              ringCreate(PIPELINE_COMMANDS_LOG),
+                              ringCreate(PIPELINE_RESULTS_LOG),
+                              {out, binary_output, 0, 0, 0}};
+  input->before_read = publishCommands;
+  input->before_read_context = pipeline.commands;
+  pipeline.results->before_wait = flushOutput;
+  pipeline.results->before_wait_context = out;
+
+  // This thread executes the commands.
+  struct ResultSink sink = {pipeline.results, {NULL, 0, 0, 0, 0},
+                            NULL, 0, 0, 0};
+  struct WaitContext wait = {&sink, tree};
+  pipeline.commands->before_wait = beforeWait;
+  pipeline.commands->before_wait_context = &wait;
+
+  pthread_t parser, formatter;
+  if (pthread_create(&parser, NULL, parserThread, &pipeline) != 0 ||
+      pthread_create(&formatter, NULL, formatterThread, &pipeline) != 0)
+    exit(1);
+
+  struct Command command;
+  do {
+    popCommand(pipeline.commands, &command);
+    executeCommand(&sink, tree, &command);
+  } while (command.type != COMMAND_END);
+
+  emitResult(&sink, RESULT_END);
+  ringPublish(pipeline.results);
+  free(sink.held);
+
+  pthread_join(parser, NULL);
+  pthread_join(formatter, NULL);
+  ringDestroy(pipeline.commands);
+  ringDestroy(pipeline.results);
+}
+
+#endif
+
+// Rewrite the input in the format given by [convert_mode], nothing is
+// executed.
+static void runConvert(struct InputReader *input, struct Output *out) {
+  if (convert_mode == CONVERT_RESULTS_TO_TEXT) {
+    struct Formatter format = {out, 0, 0, 0, 0};
+    const char *word;
+    while (inputReadRecord(input, sizeof(int32_t), &word) == INPUT_OK)
+      formatResult(&format, loadInt32(word));
+
+    return;
+  }
+
+  struct Parser parser = {input, convert_mode == CONVERT_COMMANDS_TO_TEXT, 0};
+  struct Command command;
+  do {
+    parseCommand(&parser, &command);
+    if (convert_mode == CONVERT_COMMANDS_TO_BINARY)
+      commandWriteBinary(out, &command);
+    else
+      commandWriteText(out, &command);
+  } while (command.type != COMMAND_END);
+}
+
+// Parse a non-negative number given to an option. Returns 1 on success, 0 if
+// [value] is not a number or does not fit in int32_t.
+static int parseOptionNumber(const char *value, int32_t *res) {
+  char *end;
+  long number = strtol(value, &end, 10);
+  if (!inRange('0', '9', value[0]) || *end != '\0' || number > INT32_MAX)
+    return 0;
+
+  *res = number;
+  return 1;
+}
+
+// Parse the command line options into [tree] settings and [max_users].
+// Returns 1 on success, 0 if an option is not recognized.
+static int parseOptions(int argc, char **argv, struct Tree *tree) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--merge=heap") == 0) {
+      tree->merge = MARATHON_MERGE_HEAP;
+    } else if (strcmp(argv[i], "--merge=pairwise") == 0) {
+      tree->merge = MARATHON_MERGE_PAIRWISE;
+    } else if (prefixMatch(argv[i], "--max-users=")) {
+      if (!parseOptionNumber(argv[i] + strlen("--max-users="), &max_users))
+        return 0;
+    } else if (prefixMatch(argv[i], "--cache-k=")) {
+      if (!parseOptionNumber(argv[i] + strlen("--cache-k="), &tree->cache_k))
+        return 0;
+    } else if (prefixMatch(argv[i], "--threads=")) {
+      int32_t threads;
+      if (!parseOptionNumber(argv[i] + strlen("--threads="), &threads) ||
+          threads < 1)
+        return 0;
+
+      treeSetThreads(tree, threads);
+      thread_count = threads;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      pipeline_mode = 1;
+    } else if (prefixMatch(argv[i], "--load=")) {
+      load_path = argv[i] + strlen("--load=");
+    } else if (prefixMatch(argv[i], "--journal=")) {
+      journal_path = argv[i] + strlen("--journal=");
+      if (journal_path[0] == '\0')
+        return 0;
+    } else if (prefixMatch(argv[i], "--journal-limit=")) {
+      if (!parseOptionNumber(argv[i] + strlen("--journal-limit="),
+                             &journal_limit))
+        return 0;
+    } else if (strcmp(argv[i], "--binary-input") == 0) {
+      binary_input = 1;
+    } else if (strcmp(argv[i], "--binary-output") == 0) {
+      binary_output = 1;
+    } else if (strcmp(argv[i], "--convert=commands-to-binary") == 0) {
+      convert_mode = CONVERT_COMMANDS_TO_BINARY;
+    } else if (strcmp(argv[i], "--convert=commands-to-text") == 0) {
+      convert_mode = CONVERT_COMMANDS_TO_TEXT;
+    } else if (strcmp(argv[i], "--convert=results-to-text") == 0) {
+      convert_mode = CONVERT_RESULTS_TO_TEXT;
     } else {
-      assert(!"Unexpected input state!");
+      return 0;
     }
   }
 
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  struct Tree tree = initTree();
+
+  max_users = DEFAULT_MAX_USERS;
+  thread_count = 1;
+  pipeline_mode = 0;
+  binary_input = binary_output = 0;
+  load_path = NULL;
+  journal_path = NULL;
+  journal_limit = JOURNAL_DEFAULT_LIMIT;
+  convert_mode = CONVERT_NONE;
+  if (!parseOptions(argc, argv, &tree)) {
+    fprintf(stderr,
+            "Usage: %s [--merge=heap|--merge=pairwise] [--max-users=N] "
+            "[--cache-k=N] [--threads=N] [--pipeline] [--binary-input] "
+            "[--binary-output] [--load=PATH] [--journal=PATH] "
+            "[--journal-limit=BYTES]\n"
+            "       %s --convert=commands-to-binary|commands-to-text|"
+            "results-to-text\n",
+            argv[0], argv[0]);
+    freeTree(tree);
+    return 1;
+  }
+
+  if (journal_path && convert_mode == CONVERT_NONE &&
+      !(journal = journalOpen(journal_path, journal_limit, tree))) {
+    fprintf(stderr, "Could not open the journal %s\n", journal_path);
+    freeTree(tree);
+    return 1;
+  }
+
+  if (load_path && !treeLoad(tree, load_path, NULL)) {
+    fprintf(stderr, "Could not load the snapshot %s\n", load_path);
+    if (journal)
+      journalClose(journal);
+    freeTree(tree);
+    return 1;
+  }
+
+  // Like the load command, the loaded tree replaces the recovered one.
+  if (load_path && journal)
+    journalCheckpoint(journal, tree);
+
+#if MARATHON_PARALLEL && !defined(DEBUG)
+  // Debug builds print the tree before every marathon, so they run one by one.
+  if (thread_count > 1)
+    marathon_batch = batchCreate(tree);
+#endif
+
+  struct Output *out = outputCreate();
+  struct InputReader *input = inputCreate(STDIN_FILENO);
+
+  if (convert_mode != CONVERT_NONE)
+    runConvert(input, out);
+#if MARATHON_PARALLEL && !defined(DEBUG)
+  else if (pipeline_mode && !journal)
+    runPipeline(input, out, tree);
+#endif
+  else
+    runSerial(input, out, tree);
+
+#if MARATHON_PARALLEL
+  if (marathon_batch)
+    batchDestroy(marathon_batch);
+#endif
+
+  inputDestroy(input);
+  outputDestroy(out);
+  if (journal)
+    journalClose(journal);
   freeTree(tree);
   return 0;
 }
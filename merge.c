@@ -0,0 +1,547 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "merge.h"
+
+// Signature shared by all merge kernels.
+typedef int32_t (*merge_function)(int32_t *dest, const int32_t *self,
+                                  int32_t self_size, const int32_t *other,
+                                  int32_t other_size, int32_t greater_than,
+                                  int32_t max_elements);
+
+static int32_t mergeScalar(int32_t *dest, const int32_t *self,
+                           int32_t self_size, const int32_t *other,
+                           int32_t other_size, int32_t greater_than,
+                           int32_t max_elements) {
+  int32_t i = 0, j = 0, inserted_elements = 0;
+  while ((i < self_size || j < other_size) &&
+         inserted_elements < max_elements) {
+    int32_t value;
+    if (j == other_size || (i < self_size && self[i] > other[j])) {
+      value = self[i++];
+    } else if (i == self_size || other[j] > self[i]) {
+      value = other[j++];
+    } else {
+      // Equal values are stored only once.
+      value = self[i++];
+      j++;
+    }
+
+    if (value <= greater_than)
+      break;
+
+    dest[inserted_elements++] = value;
+  }
+
+  return inserted_elements;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define MERGE_HAVE_VECTOR_KERNELS
+
+// Shuffles that move the lanes chosen by a lane mask to the front of a vector,
+// indexed by the mask. Filled by [mergeInitTables].
+static uint8_t sse_compact_table[1 << 4][16];
+static int32_t avx_compact_table[1 << 8][8];
+
+static void mergeInitTables(void) {
+  for (int mask = 0; mask < (1 << 4); ++mask) {
+    int taken = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+      if (mask & (1 << lane)) {
+        for (int byte = 0; byte < 4; ++byte)
+          sse_compact_table[mask][4 * taken + byte] = 4 * lane + byte;
+        ++taken;
+      }
+    }
+
+    // Lanes past the chosen ones are zeroed, they are never stored.
+    for (int byte = 4 * taken; byte < 16; ++byte)
+      sse_compact_table[mask][byte] = 0x80;
+  }
+
+  for (int mask = 0; mask < (1 << 8); ++mask) {
+    int taken = 0;
+    for (int lane = 0; lane < 8; ++lane)
+      if (mask & (1 << lane))
+        avx_compact_table[mask][taken++] = lane;
+
+    while (taken < 8)
+      avx_compact_table[mask][taken++] = 0;
+  }
+}
+
+// Scalar end of the vector kernels. Merge the [carry] values, left in the
+// registers, with the rest of both arrays, after [count] values were already
+// stored. Unlike in [mergeScalar], values equal to the last stored one are
+// skipped, since the carry may repeat it.
+static int32_t mergeTail(int32_t *dest, int32_t count, const int32_t *carry,
+                         int32_t carry_size, const int32_t *self,
+                         int32_t self_size, const int32_t *other,
+                         int32_t other_size, int32_t greater_than,
+                         int32_t max_elements) {
+  int32_t c = 0, i = 0, j = 0;
+  while (count < max_elements) {
+    const int32_t *best = NULL;
+    if (c < carry_size)
+      best = &carry[c];
+    if (i < self_size && (!best || self[i] > *best))
+      best = &self[i];
+    if (j < other_size && (!best || other[j] > *best))
+      best = &other[j];
+
+    if (!best || *best <= greater_than)
+      break;
+
+    int32_t value = *best;
+    if (best == &carry[c])
+      ++c;
+    else if (best == &self[i])
+      ++i;
+    else
+      ++j;
+
+    if (count == 0 || dest[count - 1] != value)
+      dest[count++] = value;
+  }
+
+  return count;
+}
+
+// Sort a bitonic sequence of 4 values in NON-INCREASING order.
+__attribute__((target("sse4.1"))) static __m128i sortBitonic4(__m128i x) {
+  // Compare lanes that are 2 apart, then neighbours. Larger values go left.
+  __m128i swapped = _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+  x = _mm_blend_epi16(_mm_max_epi32(x, swapped), _mm_min_epi32(x, swapped),
+                      0xF0);
+
+  swapped = _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+  x = _mm_blend_epi16(_mm_max_epi32(x, swapped), _mm_min_epi32(x, swapped),
+                      0xCC);
+
+  return x;
+}
+
+// Merge two sorted vectors. [high] gets the 4 largest values, [low] the rest,
+// both sorted in NON-INCREASING order.
+__attribute__((target("sse4.1"))) static void
+mergeNetwork4(__m128i a, __m128i b, __m128i *high, __m128i *low) {
+  // [a] followed by reversed [b] is bitonic, and so are the halves below.
+  __m128i reversed = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));
+  *high = sortBitonic4(_mm_max_epi32(a, reversed));
+  *low = sortBitonic4(_mm_min_epi32(a, reversed));
+}
+
+// Store the values of the sorted [block] that are greater than [limit] and
+// differ from the value stored before them. Sets [done] if no more values
+// should be stored. Returns the new number of stored values.
+__attribute__((target("sse4.1"))) static int32_t
+storeBlock4(int32_t *dest, int32_t count, int32_t capacity, __m128i block,
+            __m128i limit, int32_t max_elements, int *done) {
+  __m128i prev = _mm_set1_epi32(count ? dest[count - 1] : 0);
+  __m128i shifted = _mm_alignr_epi8(block, prev, 12);
+
+  int fresh =
+      ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, shifted))) &
+      0xF;
+  if (count == 0)
+    fresh |= 1;
+
+  int above = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, limit)));
+  if (above != 0xF)
+    *done = 1;
+
+  int mask = fresh & above;
+  __m128i packed = _mm_shuffle_epi8(
+      block, _mm_loadu_si128((const __m128i *)sse_compact_table[mask]));
+
+  int32_t stored = __builtin_popcount(mask);
+  if (stored >= max_elements - count) {
+    stored = max_elements - count;
+    *done = 1;
+  }
+
+  if (capacity - count >= 4) {
+    _mm_storeu_si128((__m128i *)(dest + count), packed);
+  } else {
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, packed);
+    for (int32_t i = 0; i < stored; ++i)
+      dest[count + i] = lanes[i];
+  }
+
+  return count + stored;
+}
+
+__attribute__((target("sse4.1"))) static int32_t
+mergeSse41(int32_t *dest, const int32_t *self, int32_t self_size,
+           const int32_t *other, int32_t other_size, int32_t greater_than,
+           int32_t max_elements) {
+  if (self_size < 4 || other_size < 4 || max_elements < 4)
+    return mergeScalar(dest, self, self_size, other, other_size, greater_than,
+                       max_elements);
+
+  int32_t capacity =
+      (int64_t)self_size + other_size < max_elements ? self_size + other_size
+                                                     : max_elements;
+  __m128i limit = _mm_set1_epi32(greater_than);
+  __m128i high, carry;
+  mergeNetwork4(_mm_loadu_si128((const __m128i *)self),
+                _mm_loadu_si128((const __m128i *)other), &high, &carry);
+
+  int32_t i = 4, j = 4, count = 0;
+  int done = 0;
+  for (;;) {
+    count = storeBlock4(dest, count, capacity, high, limit, max_elements,
+                        &done);
+    if (done)
+      return count;
+
+    // The next block comes from the array with the greater front value, so
+    // the 4 largest values after the merge are never smaller than the values
+    // still in the arrays.
+    const int32_t *next;
+    if (i < self_size && (j == other_size || self[i] > other[j])) {
+      if (i + 4 > self_size)
+        break;
+      next = self + i;
+      i += 4;
+    } else if (j < other_size) {
+      if (j + 4 > other_size)
+        break;
+      next = other + j;
+      j += 4;
+    } else {
+      break;
+    }
+
+    mergeNetwork4(carry, _mm_loadu_si128((const __m128i *)next), &high,
+                  &carry);
+  }
+
+  int32_t rest[4];
+  _mm_storeu_si128((__m128i *)rest, carry);
+  return mergeTail(dest, count, rest, 4, self + i, self_size - i, other + j,
+                   other_size - j, greater_than, max_elements);
+}
+
+// Sort a bitonic sequence of 8 values in NON-INCREASING order.
+__attribute__((target("avx2"))) static __m256i sortBitonic8(__m256i x) {
+  // Compare lanes that are 4, 2 and 1 apart. Larger values go left.
+  __m256i swapped = _mm256_permute2x128_si256(x, x, 0x01);
+  x = _mm256_blend_epi32(_mm256_max_epi32(x, swapped),
+                         _mm256_min_epi32(x, swapped), 0xF0);
+
+  swapped = _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+  x = _mm256_blend_epi32(_mm256_max_epi32(x, swapped),
+                         _mm256_min_epi32(x, swapped), 0xCC);
+
+  swapped = _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+  x = _mm256_blend_epi32(_mm256_max_epi32(x, swapped),
+                         _mm256_min_epi32(x, swapped), 0xAA);
+
+  return x;
+}
+
+// Merge two sorted vectors. [high] gets the 8 largest values, [low] the rest,
+// both sorted in NON-INCREASING order.
+__attribute__((target("avx2"))) static void
+mergeNetwork8(__m256i a, __m256i b, __m256i *high, __m256i *low) {
+  __m256i reversed = _mm256_permutevar8x32_epi32(
+      b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+  *high = sortBitonic8(_mm256_max_epi32(a, reversed));
+  *low = sortBitonic8(_mm256_min_epi32(a, reversed));
+}
+
+// Same as [storeBlock4], for 8 values.
+__attribute__((target("avx2"))) static int32_t
+storeBlock8(int32_t *dest, int32_t count, int32_t capacity, __m256i block,
+            __m256i limit, int32_t max_elements, int *done) {
+  __m256i prev = _mm256_set1_epi32(count ? dest[count - 1] : 0);
+  __m256i shifted = _mm256_blend_epi32(
+      _mm256_permutevar8x32_epi32(block,
+                                  _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6)),
+      prev, 0x01);
+
+  int fresh = ~_mm256_movemask_ps(
+                  _mm256_castsi256_ps(_mm256_cmpeq_epi32(block, shifted))) &
+              0xFF;
+  if (count == 0)
+    fresh |= 1;
+
+  int above = _mm256_movemask_ps(
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(block, limit)));
+  if (above != 0xFF)
+    *done = 1;
+
+  int mask = fresh & above;
+  __m256i packed = _mm256_permutevar8x32_epi32(
+      block, _mm256_loadu_si256((const __m256i *)avx_compact_table[mask]));
+
+  int32_t stored = __builtin_popcount(mask);
+  if (stored >= max_elements - count) {
+    stored = max_elements - count;
+    *done = 1;
+  }
+
+  if (capacity - count >= 8) {
+    _mm256_storeu_si256((__m256i *)(dest + count), packed);
+  } else {
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, packed);
+    for (int32_t i = 0; i < stored; ++i)
+      dest[count + i] = lanes[i];
+  }
+
+  return count + stored;
+}
+
+// Same as [mergeSse41], on blocks of 8 values.
+__attribute__((target("avx2"))) static int32_t
+mergeAvx2(int32_t *dest, const int32_t *self, int32_t self_size,
+          const int32_t *other, int32_t other_size, int32_t greater_than,
+          int32_t max_elements) {
+  if (self_size < 8 || other_size < 8 || max_elements < 8)
+    return mergeScalar(dest, self, self_size, other, other_size, greater_than,
+                       max_elements);
+
+  int32_t capacity =
+      (int64_t)self_size + other_size < max_elements ? self_size + other_size
+                                                     : max_elements;
+  __m256i limit = _mm256_set1_epi32(greater_than);
+  __m256i high, carry;
+  mergeNetwork8(_mm256_loadu_si256((const __m256i *)self),
+                _mm256_loadu_si256((const __m256i *)other), &high, &carry);
+
+  int32_t i = 8, j = 8, count = 0;
+  int done = 0;
+  for (;;) {
+    count = storeBlock8(dest, count, capacity, high, limit, max_elements,
+                        &done);
+    if (done)
+      return count;
+
+    const int32_t *next;
+    if (i < self_size && (j == other_size || self[i] > other[j])) {
+      if (i + 8 > self_size)
+        break;
+      next = self + i;
+      i += 8;
+    } else if (j < other_size) {
+      if (j + 8 > other_size)
+        break;
+      next = other + j;
+      j += 8;
+    } else {
+      break;
+    }
+
+    mergeNetwork8(carry, _mm256_loadu_si256((const __m256i *)next), &high,
+                  &carry);
+  }
+
+  int32_t rest[8];
+  _mm256_storeu_si256((__m256i *)rest, carry);
+  return mergeTail(dest, count, rest, 8, self + i, self_size - i, other + j,
+                   other_size - j, greater_than, max_elements);
+}
+
+#endif
+
+// Kernel used by [mergeSortedArrays], chosen on the first call.
+static merge_function merge_best_kernel = NULL;
+
+// Kernels by [enum merge_kernel], NULL if not built.
+static const merge_function merge_kernels[MERGE_KERNEL_COUNT] = {
+    [MERGE_KERNEL_SCALAR] = mergeScalar,
+#ifdef MERGE_HAVE_VECTOR_KERNELS
+    [MERGE_KERNEL_SSE41] = mergeSse41,
+    [MERGE_KERNEL_AVX2] = mergeAvx2,
+#endif
+};
+
+int mergeKernelSupported(enum merge_kernel kernel) {
+  assert(0 <= kernel && kernel < MERGE_KERNEL_COUNT);
+  if (!merge_kernels[kernel])
+    return 0;
+
+#ifdef MERGE_HAVE_VECTOR_KERNELS
+  __builtin_cpu_init();
+  if (kernel == MERGE_KERNEL_SSE41)
+    return __builtin_cpu_supports("sse4.1");
+  if (kernel == MERGE_KERNEL_AVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+
+  return 1;
+}
+
+// Choose the fastest supported kernel and prepare its tables.
+static void mergeInitKernels(void) {
+#ifdef MERGE_HAVE_VECTOR_KERNELS
+  mergeInitTables();
+#endif
+
+  merge_best_kernel = mergeScalar;
+  for (int kernel = 0; kernel < MERGE_KERNEL_COUNT; ++kernel)
+    if (mergeKernelSupported(kernel))
+      merge_best_kernel = merge_kernels[kernel];
+}
+
+void mergeInit(void) {
+  if (!merge_best_kernel)
+    mergeInitKernels();
+}
+
+int32_t mergeSortedArraysWith(enum merge_kernel kernel, int32_t *dest,
+                              const int32_t *self, int32_t self_size,
+                              const int32_t *other, int32_t other_size,
+                              int32_t greater_than, int32_t max_elements) {
+  assert(mergeKernelSupported(kernel));
+  if (!merge_best_kernel)
+    mergeInitKernels();
+
+#ifdef DEBUG
+  assert(arrayIsSorted(self, self_size));
+  assert(arrayIsSorted(other, other_size));
+#endif
+
+  return merge_kernels[kernel](dest, self, self_size, other, other_size,
+                               greater_than, max_elements);
+}
+
+int32_t mergeSortedArrays(int32_t *dest, const int32_t *self, int32_t self_size,
+                          const int32_t *other, int32_t other_size,
+                          int32_t greater_than, int32_t max_elements) {
+  if (!merge_best_kernel)
+    mergeInitKernels();
+
+#ifdef DEBUG
+  assert(arrayIsSorted(self, self_size));
+  assert(arrayIsSorted(other, other_size));
+#endif
+
+  return merge_best_kernel(dest, self, self_size, other, other_size,
+                           greater_than, max_elements);
+}
+
+void mergeScratchReserve(struct MergeScratch *scratch, int32_t count) {
+  if (count <= scratch->capacity)
+    return;
+
+  int32_t new_capacity = scratch->capacity ? scratch->capacity : 16;
+  while (new_capacity < count)
+    new_capacity *= 2;
+
+  struct MergeSource *sources =
+      realloc(scratch->sources, sizeof(struct MergeSource) * new_capacity);
+  if (!sources)
+    exit(1);
+  scratch->sources = sources;
+
+  int32_t *heap = realloc(scratch->heap, sizeof(int32_t) * new_capacity);
+  if (!heap)
+    exit(1);
+  scratch->heap = heap;
+
+  scratch->capacity = new_capacity;
+}
+
+void mergeScratchFree(struct MergeScratch *scratch) {
+  free(scratch->sources);
+  free(scratch->heap);
+  (*scratch) = (struct MergeScratch){NULL, NULL, 0};
+}
+
+// Value at the front of the source, which is the key in the heap.
+#define sourceFront(sources, idx) ((sources)[(idx)].values[0])
+
+// Restore the heap order, moving the source at [pos] down. The heap is a
+// max-heap of source indices, ordered by their front values.
+static void heapSiftDown(const struct MergeSource *sources, int32_t *heap,
+                         int32_t heap_size, int32_t pos) {
+  int32_t moved = heap[pos];
+  int32_t moved_value = sourceFront(sources, moved);
+
+  for (;;) {
+    int32_t child = 2 * pos + 1;
+    if (child >= heap_size)
+      break;
+
+    if (child + 1 < heap_size && sourceFront(sources, heap[child + 1]) >
+                                     sourceFront(sources, heap[child]))
+      ++child;
+
+    if (sourceFront(sources, heap[child]) <= moved_value)
+      break;
+
+    heap[pos] = heap[child];
+    pos = child;
+  }
+
+  heap[pos] = moved;
+}
+
+int32_t mergeKSortedArrays(int32_t *dest, struct MergeSource *sources,
+                           int32_t source_count, int32_t *heap,
+                           int32_t greater_than, int32_t max_elements) {
+  int32_t heap_size = 0;
+  for (int32_t i = 0; i < source_count; ++i) {
+#ifdef DEBUG
+    assert(arrayIsSorted(sources[i].values, sources[i].size));
+#endif
+
+    // Sources that have nothing to give are not added at all.
+    if (sources[i].size > 0 && sources[i].values[0] > greater_than)
+      heap[heap_size++] = i;
+  }
+
+  for (int32_t i = heap_size / 2 - 1; i >= 0; --i)
+    heapSiftDown(sources, heap, heap_size, i);
+
+  int32_t inserted_elements = 0;
+  while (heap_size > 0 && inserted_elements < max_elements) {
+    struct MergeSource *top = &sources[heap[0]];
+    int32_t value = top->values[0];
+
+    // Equal values are stored only once.
+    if (inserted_elements == 0 || dest[inserted_elements - 1] != value)
+      dest[inserted_elements++] = value;
+
+    top->values++;
+    top->size--;
+
+    // Remove the source from the heap once it has nothing more to give.
+    if (top->size == 0 || top->values[0] <= greater_than)
+      heap[0] = heap[--heap_size];
+
+    if (heap_size > 0)
+      heapSiftDown(sources, heap, heap_size, 0);
+  }
+
+  return inserted_elements;
+}
+
+#ifdef DEBUG
+
+int arrayIsSorted(const int32_t *values, int32_t size) {
+  for (int32_t i = 1; i < size; ++i)
+    if (values[i - 1] < values[i])
+      return 0;
+
+  return 1;
+}
+
+#endif
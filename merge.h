@@ -0,0 +1,84 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdint.h>
+
+// Merge two arrays sorted in NON-INCREASING order into [dest], also sorted in
+// NON-INCREASING order. A value found in both arrays is stored once, only
+// values greater than [greater_than] are stored, and no more than
+// [max_elements] of them: the greatest ones. There must be no repeated values
+// within one array.
+// [dest] must have space for min([self_size] + [other_size], [max_elements])
+// values and must not overlap the inputs. Returns the number of values stored.
+// Uses the fastest kernel the CPU supports.
+int32_t mergeSortedArrays(int32_t *dest, const int32_t *self, int32_t self_size,
+                          const int32_t *other, int32_t other_size,
+                          int32_t greater_than, int32_t max_elements);
+
+// Implementations of [mergeSortedArrays]. The vector ones are built only for
+// x86, and are chosen at runtime if the CPU supports them.
+enum merge_kernel {
+  // Reference implementation, one value at a time.
+  MERGE_KERNEL_SCALAR,
+
+  // Bitonic merge network on 4 values at once.
+  MERGE_KERNEL_SSE41,
+
+  // Bitonic merge network on 8 values at once.
+  MERGE_KERNEL_AVX2,
+
+  MERGE_KERNEL_COUNT
+};
+
+// 1 if [kernel] is built and the CPU can run it, else 0.
+int mergeKernelSupported(enum merge_kernel kernel);
+
+// [mergeSortedArrays] using the given [kernel], which must be supported.
+int32_t mergeSortedArraysWith(enum merge_kernel kernel, int32_t *dest,
+                              const int32_t *self, int32_t self_size,
+                              const int32_t *other, int32_t other_size,
+                              int32_t greater_than, int32_t max_elements);
+
+// Choose the kernel of [mergeSortedArrays] now instead of on the first call.
+// It must be done before the merges run on many threads.
+void mergeInit(void);
+
+// Sorted array taking part in a k-way merge. [values] and [size] are advanced
+// as the values are consumed.
+struct MergeSource {
+  const int32_t *values;
+  int32_t size;
+};
+
+// Reusable memory for [mergeKSortedArrays].
+struct MergeScratch {
+  struct MergeSource *sources;
+  int32_t *heap;
+  int32_t capacity;
+};
+
+// Make [scratch] big enough for a merge of [count] arrays. Aborts with error
+// code 1 if could not allocate memory.
+void mergeScratchReserve(struct MergeScratch *scratch, int32_t count);
+
+void mergeScratchFree(struct MergeScratch *scratch);
+
+// Merge all [source_count] arrays at once with a binary heap, with the same
+// semantics as [mergeSortedArrays]. Runs in O((source_count + max_elements) *
+// log(source_count)). [heap] must have space for [source_count] values and
+// [dest] for min(sum of sizes, [max_elements]) values.
+int32_t mergeKSortedArrays(int32_t *dest, struct MergeSource *sources,
+                           int32_t source_count, int32_t *heap,
+                           int32_t greater_than, int32_t max_elements);
+
+#ifdef DEBUG
+
+// 1 if given array is sorted in NON-INCREASING order, else 0.
+int arrayIsSorted(const int32_t *values, int32_t size);
+
+#endif
+
+#endif
@@ -0,0 +1,174 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "output.h"
+
+// Size of the buffer of every stream.
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Longest decimal representation of an int32, with the sign.
+#define INT32_MAX_DIGITS (11)
+
+// Pairs of digits of all numbers from 00 to 99.
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// 1 if both file descriptors point to the same file.
+static int sameDestination(int first, int second) {
+  struct stat first_info, second_info;
+  if (fstat(first, &first_info) != 0 || fstat(second, &second_info) != 0)
+    return 0;
+
+  return first_info.st_dev == second_info.st_dev &&
+         first_info.st_ino == second_info.st_ino;
+}
+
+struct Output *outputCreate(void) {
+  struct Output *out = malloc(sizeof(struct Output));
+  if (!out)
+    exit(1);
+
+  const int fds[OUTPUT_STREAM_COUNT] = {STDOUT_FILENO, STDERR_FILENO};
+  for (int i = 0; i < OUTPUT_STREAM_COUNT; ++i) {
+    char *data = malloc(OUTPUT_BUFFER_SIZE);
+    if (!data)
+      exit(1);
+
+    out->buffers[i] =
+        (struct OutputBuffer){fds[i], data, 0, OUTPUT_BUFFER_SIZE};
+  }
+
+  out->shared = sameDestination(STDOUT_FILENO, STDERR_FILENO);
+  out->last = OUTPUT_STDOUT;
+  out->before_flush = NULL;
+  out->before_flush_context = NULL;
+  return out;
+}
+
+void outputDestroy(struct Output *out) {
+  outputFlush(out);
+  for (int i = 0; i < OUTPUT_STREAM_COUNT; ++i)
+    free(out->buffers[i].data);
+
+  free(out);
+}
+
+// Write the whole [buffer] to its file. On a write error the content is
+// dropped, as there is no one to report it to.
+static void outputFlushBuffer(struct Output *out,
+                              struct OutputBuffer *buffer) {
+  if (buffer->size > 0 && buffer == &out->buffers[OUTPUT_STDOUT] &&
+      out->before_flush)
+    out->before_flush(out->before_flush_context);
+
+  size_t written = 0;
+  while (written < buffer->size) {
+    ssize_t bytes =
+        write(buffer->fd, buffer->data + written, buffer->size - written);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes <= 0)
+      break;
+
+    written += bytes;
+  }
+
+  buffer->size = 0;
+}
+
+void outputFlush(struct Output *out) {
+  // The stream written last has the newest content, so it goes second.
+  outputFlushBuffer(out, &out->buffers[!out->last]);
+  outputFlushBuffer(out, &out->buffers[out->last]);
+}
+
+// Get the buffer of the [stream] with at least [length] free characters.
+// [length] must not exceed [OUTPUT_BUFFER_SIZE].
+static struct OutputBuffer *outputReserve(struct Output *out,
+                                          enum output_stream stream,
+                                          size_t length) {
+  assert(0 <= stream && stream < OUTPUT_STREAM_COUNT);
+  assert(length <= OUTPUT_BUFFER_SIZE);
+
+  if (out->shared && stream != out->last)
+    outputFlushBuffer(out, &out->buffers[out->last]);
+  out->last = stream;
+
+  struct OutputBuffer *buffer = &out->buffers[stream];
+  if (buffer->capacity - buffer->size < length)
+    outputFlushBuffer(out, buffer);
+
+  return buffer;
+}
+
+void outputString(struct Output *out, enum output_stream stream,
+                  const char *text, size_t length) {
+  while (length > 0) {
+    size_t part = length < OUTPUT_BUFFER_SIZE ? length : OUTPUT_BUFFER_SIZE;
+    struct OutputBuffer *buffer = outputReserve(out, stream, part);
+    memcpy(buffer->data + buffer->size, text, part);
+    buffer->size += part;
+
+    text += part;
+    length -= part;
+  }
+}
+
+void outputInt32(struct Output *out, enum output_stream stream, int32_t value) {
+  struct OutputBuffer *buffer = outputReserve(out, stream, INT32_MAX_DIGITS);
+
+  // Work on the absolute value as unsigned, so INT32_MIN does not overflow.
+  uint32_t rest = value < 0 ? -(uint32_t)value : (uint32_t)value;
+  char digits[INT32_MAX_DIGITS];
+  char *pos = digits + INT32_MAX_DIGITS;
+
+  // Digits are produced from the end, two at a time.
+  while (rest >= 100) {
+    uint32_t pair = rest % 100;
+    rest /= 100;
+    pos -= 2;
+    memcpy(pos, digit_pairs + 2 * pair, 2);
+  }
+
+  if (rest >= 10) {
+    pos -= 2;
+    memcpy(pos, digit_pairs + 2 * rest, 2);
+  } else {
+    *(--pos) = '0' + rest;
+  }
+
+  if (value < 0)
+    *(--pos) = '-';
+
+  size_t length = digits + INT32_MAX_DIGITS - pos;
+  memcpy(buffer->data + buffer->size, pos, length);
+  buffer->size += length;
+}
+
+void outputBinaryInt32(struct Output *out, enum output_stream stream,
+                       int32_t value) {
+  struct OutputBuffer *buffer = outputReserve(out, stream, sizeof(value));
+  uint32_t bits = value;
+  for (size_t i = 0; i < sizeof(value); ++i)
+    buffer->data[buffer->size++] = bits >> (8 * i);
+}
@@ -0,0 +1,62 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum output_stream { OUTPUT_STDOUT, OUTPUT_STDERR, OUTPUT_STREAM_COUNT };
+
+struct OutputBuffer {
+  int fd;
+  char *data;
+  size_t size, capacity;
+};
+
+// Buffered writer of the standard output and error. Both streams are written
+// in large blocks. If they go to the same file (for example both to the
+// terminal, or '2>&1'), the buffer of one stream is flushed before writing to
+// the other one, so the lines stay in order.
+struct Output {
+  struct OutputBuffer buffers[OUTPUT_STREAM_COUNT];
+
+  // 1 if both streams have the same destination.
+  int shared;
+
+  // Stream written to most recently.
+  enum output_stream last;
+
+  // Called before anything buffered is written to the standard output, if not
+  // NULL. Used to sync the journal, so no result is shown before the change it
+  // reports is on the disk.
+  void (*before_flush)(void *context);
+  void *before_flush_context;
+};
+
+// Aborts with error code 1 if could not allocate memory.
+struct Output *outputCreate(void);
+
+// Flush and free everything.
+void outputDestroy(struct Output *out);
+
+// Write everything buffered so far.
+void outputFlush(struct Output *out);
+
+// Append [length] characters of [text] to the [stream].
+void outputString(struct Output *out, enum output_stream stream,
+                  const char *text, size_t length);
+
+// Append a decimal representation of [value] to the [stream].
+void outputInt32(struct Output *out, enum output_stream stream, int32_t value);
+
+// Append [value] as 4 bytes, the lowest one first.
+void outputBinaryInt32(struct Output *out, enum output_stream stream,
+                       int32_t value);
+
+// [outputString] for a string literal.
+#define outputLiteral(out, stream, literal)                                    \
+  outputString((out), (stream), (literal), sizeof(literal) - 1)
+
+#endif
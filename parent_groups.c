@@ -0,0 +1,116 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "parent_groups.h"
+
+// Number of groups before the arrays grow for the first time.
+#define GROUPS_INITIAL_CAPACITY (1024)
+
+// Change the capacity to [capacity] groups and put the new ones on the free
+// list. Aborts with error code 1 if could not allocate memory.
+static void groupsResize(struct ParentGroups *groups, int32_t capacity) {
+  assert(capacity > groups->capacity);
+
+  int32_t *link = realloc(groups->link, sizeof(int32_t) * capacity);
+  int32_t *owner = realloc(groups->owner, sizeof(int32_t) * capacity);
+  int32_t *refs = realloc(groups->refs, sizeof(int32_t) * capacity);
+  int32_t *size = realloc(groups->size, sizeof(int32_t) * capacity);
+  if (!link || !owner || !refs || !size)
+    exit(1);
+
+  for (int32_t i = groups->capacity; i < capacity; ++i)
+    link[i] = i + 1 < capacity ? i + 1 : groups->free_list;
+
+  groups->free_list = groups->capacity;
+  groups->link = link;
+  groups->owner = owner;
+  groups->refs = refs;
+  groups->size = size;
+  groups->capacity = capacity;
+}
+
+void groupsInit(struct ParentGroups *groups) {
+  (*groups) = (struct ParentGroups){NULL, NULL, NULL, NULL, 0, -1};
+  groupsResize(groups, GROUPS_INITIAL_CAPACITY);
+}
+
+void groupsFree(struct ParentGroups *groups) {
+  free(groups->link);
+  free(groups->owner);
+  free(groups->refs);
+  free(groups->size);
+}
+
+int32_t groupCreate(struct ParentGroups *groups, int32_t owner) {
+  if (groups->free_list == -1)
+    groupsResize(groups, 2 * groups->capacity);
+
+  int32_t group = groups->free_list;
+  groups->free_list = groups->link[group];
+
+  groups->link[group] = -1;
+  groups->owner[group] = owner;
+  groups->refs[group] = 1;
+  groups->size[group] = 1;
+  return group;
+}
+
+void groupAcquire(struct ParentGroups *groups, int32_t group) {
+  assert(groups->refs[group] > 0);
+  groups->refs[group]++;
+}
+
+void groupRelease(struct ParentGroups *groups, int32_t group) {
+  // A freed group drops its link, which may free the next one.
+  while (group != -1) {
+    assert(groups->refs[group] > 0);
+    if (--groups->refs[group] > 0)
+      break;
+
+    int32_t next = groups->link[group];
+    groups->link[group] = groups->free_list;
+    groups->free_list = group;
+    group = next;
+  }
+}
+
+int32_t groupFind(const struct ParentGroups *groups, int32_t group) {
+  while (groups->link[group] != -1)
+    group = groups->link[group];
+
+  return group;
+}
+
+int32_t groupMerge(struct ParentGroups *groups, int32_t into, int32_t from) {
+  assert(groups->link[into] == -1 && groups->link[from] == -1);
+  assert(into != from);
+
+  if (groups->size[into] >= groups->size[from]) {
+    groups->link[from] = into;
+    groups->size[into] += groups->size[from];
+    groupAcquire(groups, into);
+
+    // The owner of [from] is gone. If none of its childs were left, [from]
+    // is freed right away.
+    groupRelease(groups, from);
+    return into;
+  }
+
+  // The reference of the owner of [from] is taken over by the owner of
+  // [into], which no longer references [into] directly.
+  groups->link[into] = from;
+  groups->size[from] += groups->size[into];
+  groups->owner[from] = groups->owner[into];
+  groupAcquire(groups, from);
+  groupRelease(groups, into);
+  return from;
+}
@@ -0,0 +1,65 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef PARENT_GROUPS_H
+#define PARENT_GROUPS_H
+
+#include <stdint.h>
+
+// Union-find forest of groups, used to find the parent of a node. Childs do
+// not point to their parent, but to a group owned by it. When a node is
+// deleted, its group is merged with the group of its parent, so all of its
+// childs get the new parent at once, without visiting them.
+//
+// Only the root of a set knows the owner. Groups are reference counted:
+// a group is referenced by its members, by the groups linked to it and by its
+// owner (if it is a root). A group with no references is freed and reused.
+struct ParentGroups {
+  // Next group towards the root of the set, -1 for a root. For a free group,
+  // the next free group.
+  int32_t *link;
+
+  // Owner of every root group.
+  int32_t *owner;
+
+  int32_t *refs;
+
+  // Number of groups in the set of every root group.
+  int32_t *size;
+
+  int32_t capacity;
+
+  // First free group, -1 if there is none.
+  int32_t free_list;
+};
+
+// Aborts with error code 1 if could not allocate memory.
+void groupsInit(struct ParentGroups *groups);
+
+void groupsFree(struct ParentGroups *groups);
+
+// Get a new group of [owner], referenced only by the owner. Aborts with error
+// code 1 if could not allocate memory.
+int32_t groupCreate(struct ParentGroups *groups, int32_t owner);
+
+// Add a reference to the [group].
+void groupAcquire(struct ParentGroups *groups, int32_t group);
+
+// Drop a reference to the [group], and free the groups that are not
+// referenced anymore.
+void groupRelease(struct ParentGroups *groups, int32_t group);
+
+// Root of the set of [group].
+int32_t groupFind(const struct ParentGroups *groups, int32_t group);
+
+// Merge the set of root [from] into the set of root [into]. The owner of
+// [into] owns the merged set, and the reference of the owner of [from] is
+// dropped. Returns the root of the merged set, which the owner of [into]
+// references now. Takes constant time; sets are merged by size, so every
+// group is at most a logarithmic number of links away from its root.
+int32_t groupMerge(struct ParentGroups *groups, int32_t into, int32_t from);
+
+// Owner of the root [group].
+#define groupOwner(groups, group) ((groups)->owner[(group)])
+
+#endif
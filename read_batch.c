@@ -0,0 +1,244 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include "read_batch.h"
+
+#if MARATHON_PARALLEL
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+// Number of marathons queued at once. More of them would only delay the
+// output.
+#define BATCH_MAX_SIZE (1024)
+
+struct BatchQuery {
+  // View of the tree the marathon reads, and its epoch.
+  struct Tree view;
+  uint64_t epoch;
+
+  int32_t node, k;
+
+  // Result, set when the marathon is done.
+  int32_t *values;
+  int32_t size;
+};
+
+struct ReadBatch {
+  struct WorkPool *pool;
+
+  // Scratch memory of every worker of the pool. The dispatcher is worker 0.
+  struct TreeScratch **scratch;
+  int32_t threads;
+
+  // Queries in a ring. They are added, done and taken in order, so
+  // [taken] <= [done] <= [added]. [added] is changed by the thread of the
+  // commands with [lock] held, [done] by the dispatcher, [taken] is only seen
+  // by the thread of the commands.
+  struct BatchQuery queries[BATCH_MAX_SIZE];
+  int64_t added, taken;
+  _Atomic int64_t done;
+
+  pthread_t dispatcher;
+  pthread_mutex_t lock;
+
+  // Signalled when a query is added or the batch is stopped, and when the
+  // queries are done.
+  pthread_cond_t wake, finish;
+  int stop;
+};
+
+// Keep the result of the [query], [size] values. Aborts with error code 1 if
+// could not allocate memory.
+static void batchKeep(struct BatchQuery *query, const int32_t *values,
+                      int32_t size) {
+  query->values = NULL;
+  query->size = size;
+  if (size > 0) {
+    query->values = malloc(sizeof(int32_t) * size);
+    if (!query->values)
+      exit(1);
+
+    memcpy(query->values, values, sizeof(int32_t) * size);
+  }
+}
+
+// Used as [pool_task], runs a single query of the batch.
+static void batchRunQuery(void *context, int32_t worker, const void *data) {
+  struct ReadBatch *batch = context;
+  struct BatchQuery *query =
+      &batch->queries[(const struct BatchQuery *)data - batch->queries];
+
+  // The other threads run the other queries.
+  struct Tree view = query->view;
+  view.parallel = NULL;
+
+  const int32_t *values;
+  int32_t size = runViewMarathon(view, batch->scratch[worker], query->node,
+                                 query->k, &values);
+  batchKeep(query, values, size);
+}
+
+// Run the queries from [first] to [last], which do not wrap around the ring.
+static void batchRunQueries(struct ReadBatch *batch, int64_t first,
+                            int64_t last) {
+  struct BatchQuery *queries = &batch->queries[first % BATCH_MAX_SIZE];
+  int32_t count = (int32_t)(last - first);
+
+  // A single marathon is split over all threads, if its subtree is big.
+  if (count == 1) {
+    const int32_t *values;
+    int32_t size = runViewMarathon(queries->view, batch->scratch[0],
+                                   queries->node, queries->k, &values);
+    batchKeep(queries, values, size);
+    return;
+  }
+
+  poolRun(batch->pool, queries, count, sizeof(struct BatchQuery),
+          batchRunQuery, batch);
+}
+
+// The dispatcher thread: runs all queries added so far at once, until the
+// batch is stopped.
+static void *batchDispatch(void *context) {
+  struct ReadBatch *batch = context;
+
+  pthread_mutex_lock(&batch->lock);
+  for (;;) {
+    int64_t first = atomic_load_explicit(&batch->done, memory_order_relaxed);
+    while (!batch->stop && batch->added == first)
+      pthread_cond_wait(&batch->wake, &batch->lock);
+
+    // The queued ones are done before it stops.
+    if (batch->added == first)
+      break;
+
+    int64_t last = MIN(batch->added,
+                       first + BATCH_MAX_SIZE - first % BATCH_MAX_SIZE);
+    pthread_mutex_unlock(&batch->lock);
+
+    batchRunQueries(batch, first, last);
+
+    pthread_mutex_lock(&batch->lock);
+    atomic_store_explicit(&batch->done, last, memory_order_release);
+    pthread_cond_broadcast(&batch->finish);
+  }
+
+  pthread_mutex_unlock(&batch->lock);
+  return NULL;
+}
+
+struct ReadBatch *batchCreate(struct Tree tree) {
+  struct ReadBatch *batch = malloc(sizeof(struct ReadBatch));
+  if (!batch)
+    exit(1);
+
+  batch->pool = treePool(tree);
+  assert(batch->pool);
+  batch->threads = poolThreads(batch->pool);
+  batch->scratch = malloc(sizeof(struct TreeScratch *) * batch->threads);
+  if (!batch->scratch)
+    exit(1);
+
+  for (int32_t i = 0; i < batch->threads; ++i)
+    batch->scratch[i] = treeScratchCreate();
+
+  batch->added = batch->taken = 0;
+  atomic_init(&batch->done, 0);
+  batch->stop = 0;
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->wake, NULL);
+  pthread_cond_init(&batch->finish, NULL);
+  if (pthread_create(&batch->dispatcher, NULL, batchDispatch, batch) != 0)
+    exit(1);
+
+  return batch;
+}
+
+void batchDestroy(struct ReadBatch *batch) {
+  pthread_mutex_lock(&batch->lock);
+  batch->stop = 1;
+  pthread_cond_signal(&batch->wake);
+  pthread_mutex_unlock(&batch->lock);
+  pthread_join(batch->dispatcher, NULL);
+
+  for (; batch->taken < batch->added; ++batch->taken)
+    free(batch->queries[batch->taken % BATCH_MAX_SIZE].values);
+
+  for (int32_t i = 0; i < batch->threads; ++i)
+    treeScratchDestroy(batch->scratch[i]);
+
+  pthread_mutex_destroy(&batch->lock);
+  pthread_cond_destroy(&batch->wake);
+  pthread_cond_destroy(&batch->finish);
+  free(batch->scratch);
+  free(batch);
+}
+
+int batchAdd(struct ReadBatch *batch, struct Tree tree, int user, int32_t k) {
+  assert(!batchFull(batch));
+
+  int32_t node = treeViewNode(tree, user);
+  if (node < 0)
+    return 0;
+
+  struct BatchQuery *query = &batch->queries[batch->added % BATCH_MAX_SIZE];
+  query->epoch = treeViewTake(tree, &query->view);
+  query->node = node;
+  query->k = k;
+
+  pthread_mutex_lock(&batch->lock);
+  batch->added++;
+  pthread_cond_signal(&batch->wake);
+  pthread_mutex_unlock(&batch->lock);
+
+  return 1;
+}
+
+int batchFull(const struct ReadBatch *batch) {
+  return batch->added - batch->taken == BATCH_MAX_SIZE;
+}
+
+int batchPending(const struct ReadBatch *batch) {
+  return batch->added > batch->taken;
+}
+
+void batchTake(struct ReadBatch *batch, struct Tree tree, int wait,
+               batch_result emit, void *context) {
+  int64_t done = atomic_load_explicit(&batch->done, memory_order_acquire);
+  if (wait && done < batch->added) {
+    pthread_mutex_lock(&batch->lock);
+    while ((done = atomic_load_explicit(&batch->done, memory_order_acquire)) <
+           batch->added)
+      pthread_cond_wait(&batch->finish, &batch->lock);
+
+    pthread_mutex_unlock(&batch->lock);
+  }
+
+  if (done == batch->taken)
+    return;
+
+  for (; batch->taken < done; ++batch->taken) {
+    struct BatchQuery *query = &batch->queries[batch->taken % BATCH_MAX_SIZE];
+    emit(context, query->values, query->size);
+    free(query->values);
+  }
+
+  // Views up to the oldest query that is not done may still be read.
+  uint64_t oldest = UINT64_MAX;
+  if (batch->taken < batch->added)
+    oldest = batch->queries[batch->taken % BATCH_MAX_SIZE].epoch;
+
+  treeViewsRelease(tree, oldest);
+}
+
+#endif
@@ -0,0 +1,54 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef READ_BATCH_H
+#define READ_BATCH_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "work_pool.h"
+
+#if MARATHON_PARALLEL
+
+// Marathons that run on other threads while the commands go on. Every one of
+// them reads a view of the tree as it was when it was added, see
+// [treeViewTake], so the tree can change right away. A dispatcher thread takes
+// all marathons added so far and runs them at once on the threads of the
+// tree; a single one is split over all of them. Their results are given back
+// in the order they were added, on the thread that adds them.
+struct ReadBatch;
+
+// Receives the result of a marathon, [size] values in descending order.
+typedef void (*batch_result)(void *context, const int32_t *values,
+                             int32_t size);
+
+// A batch that runs on the threads of the [tree], which must have more than
+// one. Nothing else may run marathons on them until the batch is destroyed.
+// Aborts with error code 1 if could not allocate memory or start a thread.
+struct ReadBatch *batchCreate(struct Tree tree);
+
+// Wait for the queued marathons and stop the dispatcher. Results that were
+// not taken are lost.
+void batchDestroy(struct ReadBatch *batch);
+
+// Queue a marathon from [user] of the [tree] as it is now, for [k] values.
+// Returns 0 if there is no such user, nothing is queued then. The batch must
+// not be full. Aborts with error code 1 if could not allocate memory.
+int batchAdd(struct ReadBatch *batch, struct Tree tree, int user, int32_t k);
+
+// 1 if no more marathons can be queued until the results are taken.
+int batchFull(const struct ReadBatch *batch);
+
+// 1 if some queued marathons were not taken yet.
+int batchPending(const struct ReadBatch *batch);
+
+// Call [emit] for the marathons that are done, in the order they were added,
+// up to the first one that is not. If [wait], waits for all of them. The views
+// they read are released from the [tree].
+void batchTake(struct ReadBatch *batch, struct Tree tree, int wait,
+               batch_result emit, void *context);
+
+#endif
+
+#endif
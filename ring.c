@@ -0,0 +1,127 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+// For sched_yield.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+struct Ring *ringCreate(int capacity_log) {
+  int64_t capacity = (int64_t)1 << capacity_log;
+  assert(capacity > RING_BATCH);
+
+  struct Ring *ring = aligned_alloc(64, sizeof(struct Ring));
+  int32_t *words = malloc(sizeof(int32_t) * capacity);
+  if (!ring || !words)
+    exit(1);
+
+  ring->words = words;
+  ring->mask = capacity - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->write = ring->tail_seen = 0;
+  ring->read = ring->head_seen = 0;
+  atomic_init(&ring->sleepers, 0);
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->wake, NULL);
+  ring->before_wait = NULL;
+  ring->before_wait_context = NULL;
+
+  return ring;
+}
+
+void ringDestroy(struct Ring *ring) {
+  pthread_mutex_destroy(&ring->lock);
+  pthread_cond_destroy(&ring->wake);
+  free(ring->words);
+  free(ring);
+}
+
+// Wake the other thread if it sleeps. Called after an index is stored. Both
+// the index and [sleepers] are sequentially consistent, so either the sleeper
+// sees the new index before it sleeps, or this sees the sleeper.
+static void ringWake(struct Ring *ring) {
+  if (atomic_load(&ring->sleepers) > 0) {
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->wake);
+    pthread_mutex_unlock(&ring->lock);
+  }
+}
+
+// 1 if the producer has no room for a word, with the tail read again.
+static int ringFull(struct Ring *ring) {
+  ring->tail_seen = atomic_load(&ring->tail);
+  return ring->write - ring->tail_seen > ring->mask;
+}
+
+// 1 if the consumer has no word to take, with the head read again.
+static int ringEmpty(struct Ring *ring) {
+  ring->head_seen = atomic_load(&ring->head);
+  return ring->read == ring->head_seen;
+}
+
+// Wait while [blocked] holds. The CPU is yielded [RING_SPINS] times first,
+// as the other thread usually moves on soon, then the thread sleeps.
+static void ringWait(struct Ring *ring, int (*blocked)(struct Ring *)) {
+  for (int spins = 0; spins < RING_SPINS; ++spins) {
+    sched_yield();
+    if (!blocked(ring))
+      return;
+  }
+
+  pthread_mutex_lock(&ring->lock);
+  atomic_fetch_add(&ring->sleepers, 1);
+  while (blocked(ring))
+    pthread_cond_wait(&ring->wake, &ring->lock);
+
+  atomic_fetch_sub(&ring->sleepers, 1);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+void ringPublish(struct Ring *ring) {
+  atomic_store(&ring->head, ring->write);
+  ringWake(ring);
+}
+
+// Let the producer reuse everything that was read. Consumer only.
+static void ringRelease(struct Ring *ring) {
+  atomic_store(&ring->tail, ring->read);
+  ringWake(ring);
+}
+
+void ringPush(struct Ring *ring, int32_t word) {
+  // The consumer is seen only when the ring looks full.
+  if (ring->write - ring->tail_seen > ring->mask && ringFull(ring)) {
+    ringPublish(ring);
+    ringWait(ring, ringFull);
+  }
+
+  ring->words[ring->write & ring->mask] = word;
+  if (++ring->write % RING_BATCH == 0)
+    ringPublish(ring);
+}
+
+int32_t ringPop(struct Ring *ring) {
+  if (ring->read == ring->head_seen && ringEmpty(ring)) {
+    // Let the producer reuse everything before going to sleep.
+    ringRelease(ring);
+    if (ring->before_wait)
+      ring->before_wait(ring->before_wait_context);
+
+    ringWait(ring, ringEmpty);
+  }
+
+  int32_t word = ring->words[ring->read & ring->mask];
+  if (++ring->read % RING_BATCH == 0)
+    ringRelease(ring);
+
+  return word;
+}
@@ -0,0 +1,63 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef RING_H
+#define RING_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Words are handed over in batches of this size, so the threads touch the
+// shared indices only now and then.
+#define RING_BATCH (256)
+
+// Number of times a thread that has to wait yields the CPU before it goes to
+// sleep.
+#define RING_SPINS (64)
+
+// Queue of int32 words from one producing thread to one consuming thread,
+// without locks while both of them are busy. Pushed words become visible to
+// the consumer when a batch is full, or after [ringPublish]. A thread that has
+// to wait yields the CPU for a while, then sleeps until the other one moves
+// its index.
+struct Ring {
+  int32_t *words;
+  int64_t mask;
+
+  // Producer side. [head] is the published end of the words.
+  alignas(64) _Atomic int64_t head;
+  int64_t write, tail_seen;
+
+  // Consumer side. [tail] is the published start of the words.
+  alignas(64) _Atomic int64_t tail;
+  int64_t read, head_seen;
+
+  // Number of threads sleeping on [wake]. The one that moves its index wakes
+  // them up.
+  alignas(64) _Atomic int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+
+  // Called by the consumer before it waits for more words, if not NULL.
+  void (*before_wait)(void *context);
+  void *before_wait_context;
+};
+
+// Create a ring for 2^[capacity_log] words. Aborts with error code 1 if could
+// not allocate memory.
+struct Ring *ringCreate(int capacity_log);
+
+void ringDestroy(struct Ring *ring);
+
+// Add [word] at the end, waiting if the ring is full. Producer only.
+void ringPush(struct Ring *ring, int32_t word);
+
+// Make all pushed words visible to the consumer. Producer only.
+void ringPublish(struct Ring *ring);
+
+// Take the first word, waiting if there is none. Consumer only.
+int32_t ringPop(struct Ring *ring);
+
+#endif
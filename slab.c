@@ -0,0 +1,265 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+// For MAP_ANONYMOUS, MAP_HUGETLB and madvise.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+#include "utils.h"
+
+// Size of a regular slab and of a huge-page-backed one.
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_HUGE_SIZE (2 * 1024 * 1024)
+
+// Objects are aligned to this value, it is enough for all the tree structs.
+#define SLAB_ALIGNMENT (sizeof(void *))
+
+// Every slab starts with this header. The slabs of one class form a list, so
+// they can all be released when the allocator is destroyed.
+struct SlabHeader {
+  struct SlabHeader *next;
+  int mapped;
+};
+
+// Space taken by the header, rounded up so the first object is aligned.
+#define SLAB_HEADER_SIZE                                                       \
+  ((sizeof(struct SlabHeader) + SLAB_ALIGNMENT - 1) & ~(SLAB_ALIGNMENT - 1))
+
+// Get [size] bytes of memory, using huge pages if requested. Returns NULL on
+// failure. [mapped] is set to 1 if memory must be released with munmap.
+static void *slabGetMemory(size_t size, int use_huge_pages, int *mapped) {
+  *mapped = 0;
+  if (!use_huge_pages)
+    return malloc(size);
+
+  void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+  // No reserved huge pages, ask for transparent ones.
+  if (mem == MAP_FAILED) {
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    if (mem == MAP_FAILED)
+      return NULL;
+
+#ifdef MADV_HUGEPAGE
+    madvise(mem, size, MADV_HUGEPAGE);
+#endif
+  }
+
+  *mapped = 1;
+  return mem;
+}
+
+// Add a new slab to the [cache]. Aborts with error code 1 if could not
+// allocate memory.
+static void slabGrow(struct SlabAllocator *alloc, struct SlabCache *cache) {
+  int mapped;
+  struct SlabHeader *slab =
+      slabGetMemory(alloc->slab_size, alloc->use_huge_pages, &mapped);
+  if (!slab)
+    exit(1);
+
+  slab->next = cache->slabs;
+  slab->mapped = mapped;
+  cache->slabs = slab;
+  cache->slab_count++;
+
+  cache->bump = (char *)slab + SLAB_HEADER_SIZE;
+  cache->bump_end = (char *)slab + alloc->slab_size;
+}
+
+struct SlabAllocator *
+slabCreate(const size_t object_sizes[SLAB_OBJECT_CLASS_COUNT],
+           int use_huge_pages) {
+  struct SlabAllocator *alloc = malloc(sizeof(struct SlabAllocator));
+  if (!alloc)
+    exit(1);
+
+  alloc->use_huge_pages = use_huge_pages;
+  alloc->slab_size = use_huge_pages ? SLAB_HUGE_SIZE : SLAB_SIZE;
+  alloc->large_buffers = alloc->large_bytes = 0;
+
+  for (int i = 0; i < SLAB_CLASS_COUNT; ++i) {
+    size_t size = i < SLAB_FIRST_BUFFER
+                      ? object_sizes[i]
+                      : (size_t)SLAB_MIN_BUFFER << (i - SLAB_FIRST_BUFFER);
+
+    // The object must be able to hold a free list link.
+    size = size < sizeof(void *) ? sizeof(void *) : size;
+    size = (size + SLAB_ALIGNMENT - 1) & ~(SLAB_ALIGNMENT - 1);
+    assert(SLAB_HEADER_SIZE + size <= alloc->slab_size);
+
+    alloc->caches[i] = (struct SlabCache){size, NULL, NULL, NULL, NULL, 0, 0};
+  }
+
+  return alloc;
+}
+
+void slabDestroy(struct SlabAllocator *alloc) {
+  for (int i = 0; i < SLAB_CLASS_COUNT; ++i) {
+    struct SlabHeader *slab = alloc->caches[i].slabs;
+    while (slab) {
+      struct SlabHeader *next = slab->next;
+      if (slab->mapped)
+        munmap(slab, alloc->slab_size);
+      else
+        free(slab);
+
+      slab = next;
+    }
+  }
+
+  free(alloc);
+}
+
+void *slabAlloc(struct SlabAllocator *alloc, enum slab_class class) {
+  assert(0 <= class && class < SLAB_CLASS_COUNT);
+  struct SlabCache *cache = &alloc->caches[class];
+
+  void *res;
+  if (cache->free_list) {
+    res = cache->free_list;
+    cache->free_list = *(void **)res;
+  } else {
+    if ((size_t)(cache->bump_end - cache->bump) < cache->object_size)
+      slabGrow(alloc, cache);
+
+    res = cache->bump;
+    cache->bump += cache->object_size;
+  }
+
+  cache->live_objects++;
+  return res;
+}
+
+void slabFree(struct SlabAllocator *alloc, enum slab_class class, void *ptr) {
+  assert(0 <= class && class < SLAB_CLASS_COUNT);
+  struct SlabCache *cache = &alloc->caches[class];
+  assert(ptr && cache->live_objects > 0);
+
+  *(void **)ptr = cache->free_list;
+  cache->free_list = ptr;
+  cache->live_objects--;
+}
+
+// Buffer class that holds [size] bytes, [SLAB_CLASS_COUNT] if none does.
+static enum slab_class slabBufferClass(size_t size) {
+  enum slab_class class = SLAB_FIRST_BUFFER;
+  for (size_t class_size = SLAB_MIN_BUFFER;
+       class_size < size && class < SLAB_CLASS_COUNT; class_size *= 2)
+    class++;
+
+  return class;
+}
+
+void *slabAllocBuffer(struct SlabAllocator *alloc, size_t size) {
+  enum slab_class class = slabBufferClass(size);
+  if (class < SLAB_CLASS_COUNT)
+    return slabAlloc(alloc, class);
+
+  void *res = malloc(size);
+  if (!res)
+    exit(1);
+
+  alloc->large_buffers++;
+  alloc->large_bytes += size;
+  return res;
+}
+
+void slabFreeBuffer(struct SlabAllocator *alloc, void *ptr, size_t size) {
+  if (!ptr)
+    return;
+
+  enum slab_class class = slabBufferClass(size);
+  if (class < SLAB_CLASS_COUNT) {
+    slabFree(alloc, class, ptr);
+    return;
+  }
+
+  free(ptr);
+  alloc->large_buffers--;
+  alloc->large_bytes -= size;
+}
+
+void *slabResizeBuffer(struct SlabAllocator *alloc, void *ptr, size_t old_size,
+                       size_t new_size) {
+  if (!ptr)
+    return slabAllocBuffer(alloc, new_size);
+
+  enum slab_class old_class = slabBufferClass(old_size);
+  enum slab_class new_class = slabBufferClass(new_size);
+  if (old_class == new_class && old_class < SLAB_CLASS_COUNT)
+    return ptr;
+
+  // Both are too big for the slabs, malloc may grow the buffer in place.
+  if (old_class == new_class) {
+    void *res = realloc(ptr, new_size);
+    if (!res)
+      exit(1);
+
+    alloc->large_bytes += (int64_t)new_size - (int64_t)old_size;
+    return res;
+  }
+
+  void *res = slabAllocBuffer(alloc, new_size);
+  memcpy(res, ptr, MIN(old_size, new_size));
+  slabFreeBuffer(alloc, ptr, old_size);
+  return res;
+}
+
+// Part of [reserved_bytes] not taken by live objects.
+static double slabFragmentation(int64_t live_bytes, int64_t reserved_bytes) {
+  if (!reserved_bytes)
+    return 0.0;
+
+  return 1.0 - (double)live_bytes / (double)reserved_bytes;
+}
+
+struct SlabStats slabClassStats(const struct SlabAllocator *alloc,
+                                enum slab_class class) {
+  const struct SlabCache *cache = &alloc->caches[class];
+  struct SlabStats res;
+
+  res.live_objects = cache->live_objects;
+  res.slabs = cache->slab_count;
+  res.reserved_bytes = cache->slab_count * (int64_t)alloc->slab_size;
+  res.live_bytes = cache->live_objects * (int64_t)cache->object_size;
+  res.fragmentation = slabFragmentation(res.live_bytes, res.reserved_bytes);
+
+  return res;
+}
+
+struct SlabStats slabStats(const struct SlabAllocator *alloc) {
+  struct SlabStats res = {0, 0, 0, 0, 0.0};
+  for (int i = 0; i < SLAB_CLASS_COUNT; ++i) {
+    struct SlabStats class_stats = slabClassStats(alloc, i);
+    res.live_objects += class_stats.live_objects;
+    res.slabs += class_stats.slabs;
+    res.reserved_bytes += class_stats.reserved_bytes;
+    res.live_bytes += class_stats.live_bytes;
+  }
+
+  // A buffer from malloc takes just its size.
+  res.live_objects += alloc->large_buffers;
+  res.reserved_bytes += alloc->large_bytes;
+  res.live_bytes += alloc->large_bytes;
+
+  res.fragmentation = slabFragmentation(res.live_bytes, res.reserved_bytes);
+
+  return res;
+}
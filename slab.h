@@ -0,0 +1,109 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Build with -DSLAB_USE_HUGE_PAGES=1 to back slabs with 2MB huge pages. If the
+// system has none reserved, transparent huge pages are requested instead.
+#ifndef SLAB_USE_HUGE_PAGES
+#define SLAB_USE_HUGE_PAGES (0)
+#endif
+
+// Buffers of up to this many bytes are served from the slabs, bigger ones
+// come from malloc.
+#define SLAB_MIN_BUFFER (16)
+#define SLAB_BUFFER_CLASSES (9)
+#define SLAB_MAX_BUFFER (SLAB_MIN_BUFFER << (SLAB_BUFFER_CLASSES - 1))
+
+// Size classes served by the allocator. Every class has its own slabs and its
+// own free list, so objects of one type are packed together in memory. The
+// sizes of the object classes are given to [slabCreate], buffer class i holds
+// [SLAB_MIN_BUFFER] << i bytes, see [slabAllocBuffer].
+enum slab_class {
+  SLAB_LIST_NODE,
+  SLAB_LIST,
+  SLAB_OBJECT_CLASS_COUNT,
+
+  SLAB_FIRST_BUFFER = SLAB_OBJECT_CLASS_COUNT,
+  SLAB_CLASS_COUNT = SLAB_FIRST_BUFFER + SLAB_BUFFER_CLASSES
+};
+
+struct SlabHeader;
+
+struct SlabCache {
+  size_t object_size;
+
+  // Intrusive list of freed objects, reused before carving new ones.
+  void *free_list;
+
+  // Not yet used part of the newest slab of this class.
+  char *bump, *bump_end;
+
+  struct SlabHeader *slabs;
+  int64_t live_objects, slab_count;
+};
+
+struct SlabAllocator {
+  struct SlabCache caches[SLAB_CLASS_COUNT];
+  size_t slab_size;
+  int use_huge_pages;
+
+  // Buffers too big for any class, taken from malloc.
+  int64_t large_buffers, large_bytes;
+};
+
+struct SlabStats {
+  int64_t live_objects;
+  int64_t slabs;
+  int64_t reserved_bytes;
+  int64_t live_bytes;
+
+  // Part of the reserved memory that does not hold a live object, in [0, 1].
+  double fragmentation;
+};
+
+// Create an allocator with given object size for every object class in
+// [slab_class]. Aborts with error code 1 if could not allocate memory.
+struct SlabAllocator *
+slabCreate(const size_t object_sizes[SLAB_OBJECT_CLASS_COUNT],
+           int use_huge_pages);
+
+// Release all slabs at once. Every object allocated from [alloc] becomes
+// invalid, there is no need to free them one by one. Buffers bigger than
+// [SLAB_MAX_BUFFER] must still be freed.
+void slabDestroy(struct SlabAllocator *alloc);
+
+// Get an object of the given class. Aborts with error code 1 if could not
+// allocate memory.
+void *slabAlloc(struct SlabAllocator *alloc, enum slab_class class);
+
+// Return the object to the free list of its class.
+void slabFree(struct SlabAllocator *alloc, enum slab_class class, void *ptr);
+
+// Get a buffer of [size] bytes from the smallest buffer class that fits it,
+// or from malloc if it is bigger than [SLAB_MAX_BUFFER]. Aborts with error code
+// 1 if could not allocate memory.
+void *slabAllocBuffer(struct SlabAllocator *alloc, size_t size);
+
+// Return a buffer of [size] bytes, the size it was allocated or last resized
+// with. NULL is ignored.
+void slabFreeBuffer(struct SlabAllocator *alloc, void *ptr, size_t size);
+
+// Resize a buffer of [old_size] bytes, or NULL, to [new_size] bytes. The
+// first of them are kept, the buffer moves only if its class changes. Aborts
+// with error code 1 if could not allocate memory.
+void *slabResizeBuffer(struct SlabAllocator *alloc, void *ptr, size_t old_size,
+                       size_t new_size);
+
+// Statistics of a single class.
+struct SlabStats slabClassStats(const struct SlabAllocator *alloc,
+                                enum slab_class class);
+
+// Statistics summed over all classes, and the buffers taken from malloc.
+struct SlabStats slabStats(const struct SlabAllocator *alloc);
+
+#endif
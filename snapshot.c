@@ -0,0 +1,244 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+// For pwrite, fsync and madvise.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "utils.h"
+
+#define SNAPSHOT_MAGIC "MARATHON"
+#define SNAPSHOT_ENDIAN (0x01020304u)
+
+// Added to the path of a snapshot while it is written.
+#define SNAPSHOT_TEMP_SUFFIX ".tmp"
+
+// Size of the write buffer, a multiple of 8 so it always holds whole words.
+#define SNAPSHOT_BUFFER_SIZE (1 << 20)
+
+// Multipliers of the checksum, odd numbers with well mixed bits.
+#define CHECKSUM_PRIME_1 (0x9E3779B185EBCA87ULL)
+#define CHECKSUM_PRIME_2 (0xC2B2AE3D27D4EB4FULL)
+
+static uint64_t rotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static void checksumInit(struct SnapshotChecksum *checksum) {
+  for (int i = 0; i < 4; ++i)
+    checksum->lanes[i] = CHECKSUM_PRIME_1 * (i + 1);
+
+  checksum->words = 0;
+}
+
+// Add [size] bytes of [data] to the checksum, [size] must be a multiple of 8.
+// Words go to the lanes in turns, so the lanes do not wait for each other.
+static void checksumUpdate(struct SnapshotChecksum *checksum, const char *data,
+                           size_t size) {
+  assert(size % 8 == 0);
+
+  for (size_t i = 0; i < size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+
+    uint64_t *lane = &checksum->lanes[checksum->words++ & 3];
+    *lane = rotateLeft(*lane + word * CHECKSUM_PRIME_2, 31) * CHECKSUM_PRIME_1;
+  }
+}
+
+static uint64_t checksumFinish(const struct SnapshotChecksum *checksum) {
+  uint64_t res = checksum->words;
+  for (int i = 0; i < 4; ++i)
+    res = rotateLeft(res ^ checksum->lanes[i], 27) * CHECKSUM_PRIME_1;
+
+  return res ^ (res >> 29);
+}
+
+// Write out the buffer, which holds whole words.
+static void snapshotFlush(struct SnapshotWriter *writer) {
+  checksumUpdate(&writer->checksum, writer->buffer, writer->size);
+  if (!writer->failed && !writeAll(writer->fd, writer->buffer, writer->size))
+    writer->failed = 1;
+
+  writer->body_size += writer->size;
+  writer->size = 0;
+}
+
+int snapshotWriterOpen(struct SnapshotWriter *writer, const char *path) {
+  size_t length = strlen(path);
+  char *temp_path = malloc(length + sizeof(SNAPSHOT_TEMP_SUFFIX));
+  if (!temp_path)
+    exit(1);
+
+  memcpy(temp_path, path, length);
+  memcpy(temp_path + length, SNAPSHOT_TEMP_SUFFIX,
+         sizeof(SNAPSHOT_TEMP_SUFFIX));
+
+  int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    free(temp_path);
+    return 0;
+  }
+
+  // The header is written at the end, when the checksum is known.
+  if (lseek(fd, sizeof(struct SnapshotHeader), SEEK_SET) < 0) {
+    close(fd);
+    unlink(temp_path);
+    free(temp_path);
+    return 0;
+  }
+
+  char *buffer = malloc(SNAPSHOT_BUFFER_SIZE);
+  if (!buffer)
+    exit(1);
+
+  (*writer) = (struct SnapshotWriter){
+      fd, path, temp_path, buffer, 0, 0, {{0}, 0}, 0};
+  checksumInit(&writer->checksum);
+  return 1;
+}
+
+void snapshotWrite(struct SnapshotWriter *writer, const void *data,
+                   size_t size) {
+  const char *bytes = data;
+  while (size > 0) {
+    size_t part = SNAPSHOT_BUFFER_SIZE - writer->size;
+    if (part > size)
+      part = size;
+
+    memcpy(writer->buffer + writer->size, bytes, part);
+    writer->size += part;
+    bytes += part;
+    size -= part;
+
+    if (writer->size == SNAPSHOT_BUFFER_SIZE)
+      snapshotFlush(writer);
+  }
+}
+
+void snapshotEndSection(struct SnapshotWriter *writer) {
+  static const char zeros[8] = {0};
+  snapshotWrite(writer, zeros, (8 - writer->size % 8) % 8);
+}
+
+int snapshotWriterCommit(struct SnapshotWriter *writer, uint64_t sequence) {
+  assert(writer->size % 8 == 0);
+  snapshotFlush(writer);
+
+  struct SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION,
+                                  SNAPSHOT_ENDIAN, writer->body_size,
+                                  checksumFinish(&writer->checksum), sequence};
+  if (!writer->failed &&
+      pwrite(writer->fd, &header, sizeof(header), 0) != sizeof(header))
+    writer->failed = 1;
+
+  // A file renamed over an older one must not turn out empty after a crash.
+  if (!writer->failed && fsync(writer->fd) != 0)
+    writer->failed = 1;
+
+  if (close(writer->fd) != 0)
+    writer->failed = 1;
+
+  writer->fd = -1;
+  if (writer->failed || rename(writer->temp_path, writer->path) != 0) {
+    unlink(writer->temp_path);
+    writer->failed = 1;
+  }
+
+  return !writer->failed;
+}
+
+void snapshotWriterFree(struct SnapshotWriter *writer) {
+  if (writer->fd >= 0)
+    close(writer->fd);
+
+  free(writer->temp_path);
+  free(writer->buffer);
+}
+
+int snapshotWriterClose(struct SnapshotWriter *writer, uint64_t sequence) {
+  int res = snapshotWriterCommit(writer, sequence);
+  snapshotWriterFree(writer);
+  return res;
+}
+
+int snapshotOpen(struct Snapshot *snapshot, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+      (size_t)info.st_size < sizeof(struct SnapshotHeader)) {
+    close(fd);
+    return 0;
+  }
+
+  void *mem = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED)
+    return 0;
+
+#ifdef MADV_SEQUENTIAL
+  madvise(mem, info.st_size, MADV_SEQUENTIAL);
+#endif
+
+  (*snapshot) = (struct Snapshot){mem, info.st_size,
+                                  sizeof(struct SnapshotHeader), 0};
+
+  const struct SnapshotHeader *header = mem;
+  size_t body_size = snapshot->size - sizeof(struct SnapshotHeader);
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != SNAPSHOT_VERSION ||
+      header->endian != SNAPSHOT_ENDIAN || header->body_size != body_size ||
+      body_size % 8 != 0) {
+    snapshotClose(snapshot);
+    return 0;
+  }
+
+  struct SnapshotChecksum checksum;
+  checksumInit(&checksum);
+  checksumUpdate(&checksum, snapshot->data + snapshot->position, body_size);
+  if (checksumFinish(&checksum) != header->checksum) {
+    snapshotClose(snapshot);
+    return 0;
+  }
+
+  snapshot->sequence = header->sequence;
+#ifdef MADV_NORMAL
+  // The sections are not read in order anymore.
+  madvise(mem, snapshot->size, MADV_NORMAL);
+#endif
+
+  return 1;
+}
+
+const void *snapshotSection(struct Snapshot *snapshot, size_t size) {
+  size_t padded = (size + 7) & ~(size_t)7;
+  if (padded < size || padded > snapshot->size - snapshot->position)
+    return NULL;
+
+  const void *section = snapshot->data + snapshot->position;
+  snapshot->position += padded;
+  return section;
+}
+
+void snapshotClose(struct Snapshot *snapshot) {
+  if (snapshot->data)
+    munmap((void *)snapshot->data, snapshot->size);
+
+  (*snapshot) = (struct Snapshot){NULL, 0, 0, 0};
+}
@@ -0,0 +1,108 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Version of the file format, files of other versions are not read.
+#define SNAPSHOT_VERSION (2)
+
+// Start of every snapshot file. The body after it is a sequence of sections,
+// each padded to a multiple of 8 bytes. Numbers are in the byte order of the
+// machine that wrote the file.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+
+  // [SNAPSHOT_ENDIAN], so a file of a machine with the other byte order is
+  // recognized.
+  uint32_t endian;
+
+  uint64_t body_size;
+
+  // Checksum of the body, see [struct SnapshotChecksum].
+  uint64_t checksum;
+
+  // Chosen by the writer, the journal stores here the number of the last
+  // segment the snapshot includes.
+  uint64_t sequence;
+};
+
+// Checksum computed over 8-byte words, in four independent lanes, so a long
+// body is hashed at the memory speed.
+struct SnapshotChecksum {
+  uint64_t lanes[4];
+  uint64_t words;
+};
+
+// Writes a snapshot file in large blocks. The file is written under a
+// temporary name and renamed when complete, so an old file at the same path is
+// replaced only by a whole new one.
+struct SnapshotWriter {
+  int fd;
+  const char *path;
+  char *temp_path;
+  char *buffer;
+  size_t size;
+
+  uint64_t body_size;
+  struct SnapshotChecksum checksum;
+
+  // 1 if some write failed, the file is not valid then.
+  int failed;
+};
+
+// Start writing the file at [path], it replaces an old one when closed. Returns
+// 0 if it could not be created. [path] must stay valid until the writer is
+// closed. Aborts with error code 1 if could not allocate memory. Writing and
+// committing the file allocates nothing, so it can be done in a child forked
+// by a process with other threads; the child has a copy of the writer.
+int snapshotWriterOpen(struct SnapshotWriter *writer, const char *path);
+
+// Append [size] bytes to the current section.
+void snapshotWrite(struct SnapshotWriter *writer, const void *data,
+                   size_t size);
+
+// End the current section, the next one starts at a multiple of 8 bytes.
+void snapshotEndSection(struct SnapshotWriter *writer);
+
+// Write the header with [sequence], sync the file to the disk and move it to
+// its path. Returns 1 if the whole file was written, else 0 and the path is not
+// changed. The memory of the writer is not freed.
+int snapshotWriterCommit(struct SnapshotWriter *writer, uint64_t sequence);
+
+// Free the memory of the writer. A file that was not committed is closed but
+// left as it is, for the process that commits it.
+void snapshotWriterFree(struct SnapshotWriter *writer);
+
+// Commit the file, see [snapshotWriterCommit], and free the writer.
+int snapshotWriterClose(struct SnapshotWriter *writer, uint64_t sequence);
+
+// Snapshot file mapped into memory. Its sections are read in the order they
+// were written.
+struct Snapshot {
+  const char *data;
+  size_t size;
+
+  // Offset of the next section.
+  size_t position;
+
+  // [sequence] of the header.
+  uint64_t sequence;
+};
+
+// Map the file at [path] and check it. Returns 0 if it could not be mapped,
+// or it is not a snapshot of [SNAPSHOT_VERSION], or its checksum is wrong.
+int snapshotOpen(struct Snapshot *snapshot, const char *path);
+
+// Pointer to the next section of [size] bytes, NULL if the file is too short.
+// It is valid until the snapshot is closed.
+const void *snapshotSection(struct Snapshot *snapshot, size_t size);
+
+// Unmap the file, if [snapshot] holds one.
+void snapshotClose(struct Snapshot *snapshot);
+
+#endif
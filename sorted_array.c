@@ -0,0 +1,124 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h> // for memmove and memcpy
+#include <stdint.h>
+
+#include "sorted_array.h"
+#include "utils.h"
+
+// Capacity of the array after the first insert.
+#define SORTED_ARRAY_MIN_CAPACITY (4)
+
+// Change the capacity of [array] to [capacity]. Borrowed values are copied.
+// Aborts with error code 1 if could not allocate memory.
+static void sortedArrayResize(struct SlabAllocator *alloc,
+                              struct SortedArray *array, int32_t capacity) {
+  assert(capacity >= array->size);
+
+  int32_t *values;
+  if (array->capacity) {
+    values = slabResizeBuffer(alloc, array->values,
+                              sizeof(int32_t) * array->capacity,
+                              sizeof(int32_t) * capacity);
+  } else {
+    values = slabAllocBuffer(alloc, sizeof(int32_t) * capacity);
+    if (array->size)
+      memcpy(values, array->values, sizeof(int32_t) * array->size);
+  }
+
+  array->values = values;
+  array->capacity = capacity;
+}
+
+void sortedArrayInit(struct SortedArray *array) {
+  (*array) = (struct SortedArray){NULL, 0, 0};
+}
+
+void sortedArrayFree(struct SlabAllocator *alloc, struct SortedArray *array) {
+  if (array->capacity)
+    slabFreeBuffer(alloc, array->values, sizeof(int32_t) * array->capacity);
+
+  sortedArrayInit(array);
+}
+
+void sortedArrayBorrow(struct SortedArray *array, const int32_t *values,
+                       int32_t size) {
+  if (size == 0)
+    sortedArrayInit(array);
+  else
+    (*array) = (struct SortedArray){(int32_t *)values, size, 0};
+}
+
+void sortedArrayUnshare(struct SlabAllocator *alloc,
+                        struct SortedArray *array) {
+  sortedArrayBorrow(array, array->values, array->size);
+  if (array->size > 0)
+    sortedArrayResize(alloc, array, array->size);
+}
+
+int32_t sortedArrayCountGreater(const struct SortedArray *array,
+                                int32_t value) {
+  int32_t low = 0, high = array->size;
+  while (low < high) {
+    int32_t mid = low + (high - low) / 2;
+    if (array->values[mid] > value)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+int sortedArrayInsert(struct SlabAllocator *alloc, struct SortedArray *array,
+                      int32_t value) {
+  int32_t pos = sortedArrayCountGreater(array, value);
+  if (pos < array->size && array->values[pos] == value)
+    return 0;
+
+  // Grow by doubling, so inserts are amortized. Borrowed values are copied
+  // here too, their capacity is 0.
+  if (array->size >= array->capacity)
+    sortedArrayResize(alloc, array,
+                      MAX(2 * array->size, SORTED_ARRAY_MIN_CAPACITY));
+
+  memmove(array->values + pos + 1, array->values + pos,
+          sizeof(int32_t) * (array->size - pos));
+  array->values[pos] = value;
+  array->size++;
+
+  return 1;
+}
+
+int sortedArrayRemove(struct SlabAllocator *alloc, struct SortedArray *array,
+                      int32_t value) {
+  int32_t pos = sortedArrayCountGreater(array, value);
+  if (pos == array->size || array->values[pos] != value)
+    return 0;
+
+  // Borrowed values are not changed in place.
+  if (!array->capacity)
+    sortedArrayResize(alloc, array,
+                      MAX(array->size, SORTED_ARRAY_MIN_CAPACITY));
+
+  memmove(array->values + pos, array->values + pos + 1,
+          sizeof(int32_t) * (array->size - pos - 1));
+  array->size--;
+
+  // Give the memory back when the array is mostly empty.
+  if (array->size == 0)
+    sortedArrayFree(alloc, array);
+  else if (array->capacity > SORTED_ARRAY_MIN_CAPACITY &&
+           array->size <= array->capacity / 4)
+    sortedArrayResize(alloc, array, array->capacity / 2);
+
+  return 1;
+}
@@ -0,0 +1,57 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef SORTED_ARRAY_H
+#define SORTED_ARRAY_H
+
+#include <stdint.h>
+
+#include "slab.h"
+
+// All functions that allocate or free values take the allocator that owns the
+// array. Small arrays take buffers from its slabs, see [slabAllocBuffer].
+
+// Set of values stored in a growable array, sorted in NON-INCREASING order.
+// Lookups are binary searches, so checking for duplicates is O(log n).
+// [values] may also be borrowed from memory the array does not own, then
+// [capacity] is 0 and they are copied before the first change.
+struct SortedArray {
+  int32_t *values;
+  int32_t size, capacity;
+};
+
+// Initialize an empty array. No memory is allocated until the first insert.
+void sortedArrayInit(struct SortedArray *array);
+
+// Free the memory of the array, which becomes empty. Borrowed values are
+// left alone.
+void sortedArrayFree(struct SlabAllocator *alloc, struct SortedArray *array);
+
+// Initialize the array with [size] values borrowed from [values], which must
+// be sorted and stay valid as long as the array uses them.
+void sortedArrayBorrow(struct SortedArray *array, const int32_t *values,
+                       int32_t size);
+
+// Copy the values to memory the array owns, the old ones are left alone.
+// Aborts with error code 1 if could not allocate memory.
+void sortedArrayUnshare(struct SlabAllocator *alloc,
+                        struct SortedArray *array);
+
+// Insert [value] keeping the sort order. The value is not inserted if it is
+// already there. Aborts with error code 1 if could not allocate memory.
+// Returns 0 if value wasn't inserted, else 1.
+int sortedArrayInsert(struct SlabAllocator *alloc, struct SortedArray *array,
+                      int32_t value);
+
+// Remove [value] from the array. Returns 0 if it was not there, else 1.
+// Aborts with error code 1 if could not allocate memory.
+int sortedArrayRemove(struct SlabAllocator *alloc, struct SortedArray *array,
+                      int32_t value);
+
+// Number of leading values that are greater than [value].
+int32_t sortedArrayCountGreater(const struct SortedArray *array, int32_t value);
+
+// The greatest value, or -1 if the array is empty.
+#define sortedArrayMax(array) ((array)->size ? (array)->values[0] : -1)
+
+#endif
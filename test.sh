@@ -8,8 +8,9 @@ PROGRAM=./main
 DIRECTORY=tests
 
 # This slows down the testing script, Uses valgrind with memcheck (default) as a
-# leakcheck tool.
-CHECK_FOR_MEM_LEAKS=true
+# leakcheck tool. Can be turned off with CHECK_FOR_MEM_LEAKS=false in the
+# environment.
+CHECK_FOR_MEM_LEAKS=${CHECK_FOR_MEM_LEAKS:-true}
 
 # The max allocation memory done by the program and the name of the test at
 # which it happend.
@@ -54,25 +55,28 @@ if [ ! -d $DIRECTORY ]; then
   exit 2
 fi
 
-# This will do the test for all subdirectories as well (not explicitly said in
-# the task description so I assumed this is how it should work).
-for i in ${DIRECTORY}/*.in ${DIRECTORY}/**/*.in; do
-  # Alias these variables to make it more readable.
-  INPUT=$i
-  OUTPUT=${i%in}out
-  ERR=${i%in}err
-
-  echo -e "Doing test on file: \e[1m$INPUT\e[0m"
+# The tests run in a scratch directory, where the program can save snapshots
+# and keep its journal, so the program and the tests need full paths.
+PROGRAM=`realpath $PROGRAM`
+SCRATCH=""
+SCRATCH_OF=""
+
+# Run the test [INPUT] once with the flags given as arguments, compare the
+# output with [OUTPUT] and [ERR] and set [TEST_OK] to false if they differ.
+runTest() {
+  if [ $# -gt 0 ]; then
+    echo -e "Flags: \e[1m$*\e[0m"
+  fi
 
-  # Check if correspoing .out and .err files exists.
-  if [ ! -f $OUTPUT ] || [ ! -f $ERR ]; then
-    echo "No corresponding files for test: $INPUT Skipping..."
-    continue
+  # The leak check runs the test again, on the files the program saw first.
+  if $CHECK_FOR_MEM_LEAKS; then
+    VALG_SCRATCH=`mktemp -d`
+    cp -R $SCRATCH/. $VALG_SCRATCH
   fi
 
   # I usedthis not unix 'time' coz i wasn't sure what will be the output of $?
   TIME_START=$(date +%s.%N)
-  $PROGRAM < $INPUT > $PROGRAM_OUT 2> $PROGRAM_ERR
+  (cd $SCRATCH && $PROGRAM "$@" < $INPUT > $PROGRAM_OUT 2> $PROGRAM_ERR)
   PROGRAM_EXIT_CODE=$?
   TIME_END=$(date +%s.%N)
 
@@ -84,12 +88,9 @@ for i in ${DIRECTORY}/*.in ${DIRECTORY}/**/*.in; do
   # to compare floating point numbers, so I used 'bc'.
   if (( `echo "$TIME_DIFF > $MAX_TIME" | bc` )); then
     MAX_TIME="$TIME_DIFF"
-    MAX_TIME_FILE=$INPUT
+    MAX_TIME_FILE=$i
   fi
 
-  # [TEST_OK] is true unless one of the tests fails.
-  TEST_OK=true
-
   if [ "$PROGRAM_EXIT_CODE" -ne "0" ]; then
     echo -n "Program execution failed with error code: "
     echo -e "\e[1;31m$PROGRAM_EXIT_CODE\e[0m"
@@ -119,9 +120,11 @@ for i in ${DIRECTORY}/*.in ${DIRECTORY}/**/*.in; do
   if $CHECK_FOR_MEM_LEAKS; then
     echo -n "Checking for memory leaks... "
 
-    valgrind --leak-check=full --log-file="$PROGRAM_VALG" \
-         --error-exitcode=1 $PROGRAM < $INPUT &> /dev/null
+    (cd $VALG_SCRATCH && valgrind --leak-check=full \
+         --log-file="$PROGRAM_VALG" --error-exitcode=1 $PROGRAM "$@" \
+         < $INPUT &> /dev/null)
     VALGR_EXIT_CODE=$?
+    rm -r $VALG_SCRATCH
 
     USAGE_INFO=`cat $PROGRAM_VALG | grep 'total heap usage'`
     regex="==[0-9]+==\s+total heap usage: ([0-9,]+) allocs, \
@@ -131,7 +134,7 @@ for i in ${DIRECTORY}/*.in ${DIRECTORY}/**/*.in; do
       ALLOCATED_SIZE=`echo ${BASH_REMATCH[3]} | tr --delete ,`
       if [ $ALLOCATED_SIZE -ge $MAX_ALLOCATED_SIZE ];then
         MAX_ALLOCATED_SIZE="$ALLOCATED_SIZE"
-        MAX_ALLOCATION_FILE="$INPUT"
+        MAX_ALLOCATION_FILE="$i"
       fi
     fi
 
@@ -143,9 +146,57 @@ for i in ${DIRECTORY}/*.in ${DIRECTORY}/**/*.in; do
       TEST_OK=false
     fi
   fi
+}
+
+# This will do the test for all subdirectories as well (not explicitly said in
+# the task description so I assumed this is how it should work).
+for i in ${DIRECTORY}/*.in ${DIRECTORY}/**/*.in; do
+  # Alias these variables to make it more readable.
+  INPUT=$i
+  OUTPUT=${i%in}out
+  ERR=${i%in}err
+  ARGS=${i%in}args
+
+  echo -e "Doing test on file: \e[1m$INPUT\e[0m"
+
+  # Check if correspoing .out and .err files exists.
+  if [ ! -f $OUTPUT ] || [ ! -f $ERR ]; then
+    echo "No corresponding files for test: $INPUT Skipping..."
+    continue
+  fi
+
+  INPUT=`realpath $INPUT`
+
+  # Tests in one directory share the scratch directory, in alphabetical order,
+  # so a test can read what the ones before it saved. It starts with a copy of
+  # the 'files' subdirectory, if there is one.
+  if [ "$SCRATCH_OF" != "$(dirname $i)" ]; then
+    if [ -n "$SCRATCH" ]; then
+      rm -r $SCRATCH
+    fi
+
+    SCRATCH_OF=$(dirname $i)
+    SCRATCH=`mktemp -d`
+    if [ -d $SCRATCH_OF/files ]; then
+      cp -R $SCRATCH_OF/files/. $SCRATCH
+    fi
+  fi
+
+  # [TEST_OK] is true unless one of the runs fails.
+  TEST_OK=true
+
+  # Every line of the .args file is a run of the test with these flags, all of
+  # them must give the same output. Without the file it runs once, with none.
+  if [ -f $ARGS ]; then
+    while read -r -a FLAGS; do
+      runTest "${FLAGS[@]}"
+    done < $ARGS
+  else
+    runTest
+  fi
 
   if ! $TEST_OK; then
-    echo "$INPUT" >> $WRONG_TESTS
+    echo "$i" >> $WRONG_TESTS
   fi
 done
 
@@ -165,6 +216,9 @@ if $CHECK_FOR_MEM_LEAKS; then
 fi
 
 # cleanup:
+if [ -n "$SCRATCH" ]; then
+  rm -r $SCRATCH
+fi
 rm $PROGRAM_OUT
 rm $PROGRAM_ERR
 rm $PROGRAM_VALG
@@ -0,0 +1,80 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+// Differential test of the merge kernels. Every kernel supported by the CPU
+// must give the same result as the scalar one on random inputs. Build and run
+// with 'make merge_test && ./merge_test'.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../merge.h"
+
+#define MAX_ARRAY_SIZE (200)
+#define ROUNDS (200000)
+
+static const char *kernel_names[MERGE_KERNEL_COUNT] = {"scalar", "sse4.1",
+                                                       "avx2"};
+
+// Fill [values] with [size] distinct values from [0, range) in
+// NON-INCREASING order.
+static void randomSortedArray(int32_t *values, int32_t size, int32_t range) {
+  int32_t taken = 0;
+  for (int32_t value = range - 1; value >= 0 && taken < size; --value)
+    if (rand() % (range - (range - 1 - value)) < size - taken)
+      values[taken++] = value;
+}
+
+int main(void) {
+  static int32_t self[MAX_ARRAY_SIZE], other[MAX_ARRAY_SIZE];
+  static int32_t expected[2 * MAX_ARRAY_SIZE], got[2 * MAX_ARRAY_SIZE + 1];
+  int failed = 0;
+
+  srand(2018);
+  for (int round = 0; round < ROUNDS && !failed; ++round) {
+    // Small ranges give many equal values in both arrays.
+    int32_t range = 2 * MAX_ARRAY_SIZE + rand() % 1000;
+    int32_t self_size = rand() % MAX_ARRAY_SIZE;
+    int32_t other_size = rand() % MAX_ARRAY_SIZE;
+    int32_t greater_than = rand() % 4 ? -1 : rand() % range;
+    int32_t max_elements = rand() % 2 ? self_size + other_size
+                                      : rand() % (2 * MAX_ARRAY_SIZE);
+
+    randomSortedArray(self, self_size, range);
+    randomSortedArray(other, other_size, range);
+
+    int32_t expected_size =
+        mergeSortedArraysWith(MERGE_KERNEL_SCALAR, expected, self, self_size,
+                              other, other_size, greater_than, max_elements);
+
+    for (int kernel = 1; kernel < MERGE_KERNEL_COUNT; ++kernel) {
+      if (!mergeKernelSupported(kernel))
+        continue;
+
+      // The value past the result must not be touched.
+      int32_t capacity = self_size + other_size < max_elements
+                             ? self_size + other_size
+                             : max_elements;
+      got[capacity] = -2;
+
+      int32_t size =
+          mergeSortedArraysWith(kernel, got, self, self_size, other, other_size,
+                                greater_than, max_elements);
+      if (size != expected_size ||
+          memcmp(got, expected, sizeof(int32_t) * size) ||
+          got[capacity] != -2) {
+        printf("%s: wrong result in round %d\n", kernel_names[kernel], round);
+        failed = 1;
+      }
+    }
+  }
+
+  for (int kernel = 0; kernel < MERGE_KERNEL_COUNT; ++kernel)
+    printf("%s: %s\n", kernel_names[kernel],
+           !mergeKernelSupported(kernel) ? "not supported"
+                                         : failed ? "FAILED" : "OK");
+
+  return failed;
+}
@@ -0,0 +1,128 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+// Churn test of the subtree bounds. High preferences are added all over a
+// random tree and then taken away, by removing them or deleting their users.
+// The bounds go up at once, and the compaction must bring every one of them
+// back down to the max of its subtree, or marathons would stop skipping
+// subtrees. Build and run with 'make tree_test && ./tree_test'.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../tree.h"
+
+#define USERS (20000)
+#define HIGH_PREFERENCES (5000)
+#define LOW_RANGE (1000)
+#define HIGH_VALUE (1000000)
+
+// Parent of every user, -1 if it is not in the tree, and its own preference.
+static int parent[2 * USERS];
+static int32_t low[2 * USERS];
+
+// Id of the next user added, ids of deleted users are not reused.
+static int next_id = 1;
+
+static int randomUser(void) {
+  int id;
+  do
+    id = rand() % next_id;
+  while (parent[id] < 0 && id != 0);
+
+  return id;
+}
+
+static void addUser(struct Tree tree) {
+  int id = next_id;
+  parent[id] = randomUser();
+  next_id++;
+  low[id] = 10 + rand() % (LOW_RANGE - 10);
+  treeAddNode(tree, id, parent[id]);
+  treeAddPreference(tree, id, low[id]);
+}
+
+static void delUser(struct Tree tree, int id) {
+  treeDelNode(tree, id);
+  for (int child = 1; child < next_id; ++child)
+    if (parent[child] == id)
+      parent[child] = parent[id];
+
+  parent[id] = -1;
+}
+
+// Compare the bound of every user with the max of its subtree. If [exact],
+// they must be equal, else the bound must not be smaller.
+static int boundsAreRight(struct Tree tree, int exact) {
+  static int32_t subtree_max[2 * USERS];
+  for (int id = 0; id < next_id; ++id)
+    subtree_max[id] = -1;
+
+  for (int id = 0; id < next_id; ++id)
+    if (id == 0 || parent[id] >= 0)
+      for (int curr = id; curr != -1 && subtree_max[curr] < low[id];
+           curr = curr == 0 ? -1 : parent[curr])
+        subtree_max[curr] = low[id];
+
+  for (int id = 0; id < next_id; ++id) {
+    if (id != 0 && parent[id] < 0)
+      continue;
+
+    int32_t bound = treeSubtreeBound(tree, id);
+    if (bound < subtree_max[id] || (exact && bound != subtree_max[id])) {
+      printf("FAIL: user %d has bound %d, the max of its subtree is %d\n", id,
+             bound, subtree_max[id]);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int main(void) {
+  static int high_user[HIGH_PREFERENCES];
+  struct Tree tree = initTree();
+  int failed = 0;
+
+  srand(2018);
+  low[0] = 10 + rand() % (LOW_RANGE - 10);
+  treeAddPreference(tree, 0, low[0]);
+  for (int i = 1; i < USERS; ++i)
+    addUser(tree);
+
+  for (int i = 0; i < HIGH_PREFERENCES; ++i) {
+    high_user[i] = randomUser();
+    treeAddPreference(tree, high_user[i], HIGH_VALUE + i);
+  }
+
+  // Half of the high preferences go with their users, which are replaced by
+  // new ones, so the nodes move too.
+  for (int i = 0; i < HIGH_PREFERENCES; ++i) {
+    if (i % 2 && high_user[i] != 0 && parent[high_user[i]] >= 0) {
+      delUser(tree, high_user[i]);
+      addUser(tree);
+    } else if (high_user[i] == 0 || parent[high_user[i]] >= 0) {
+      treeRemovePreference(tree, high_user[i], HIGH_VALUE + i);
+    }
+  }
+
+  failed |= !boundsAreRight(tree, 0);
+
+  // More changes, below every other preference, let the compaction finish a
+  // whole pass after the last high one is gone.
+  for (int i = 0; i < USERS && !failed; ++i) {
+    int id = randomUser();
+    treeAddPreference(tree, id, 5);
+    treeRemovePreference(tree, id, 5);
+  }
+
+  failed |= !failed && !boundsAreRight(tree, 1);
+
+  freeTree(tree);
+  if (!failed)
+    printf("OK: the bounds of %d users are exact after the churn\n",
+           USERS);
+
+  return failed;
+}
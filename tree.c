@@ -7,220 +7,2287 @@
 
 #include <assert.h>
 #include <malloc.h>
+#include <stdatomic.h>
 #include <stdlib.h>
-#include <string.h> // for memset
+#include <string.h> // for memset, memcpy and memmove
 #include <stdint.h>
 
+#include "arena.h"
+#include "id_map.h"
 #include "linked_list.h"
+#include "merge.h"
+#include "parent_groups.h"
+#include "snapshot.h"
+#include "sorted_array.h"
 #include "tree.h"
 #include "utils.h"
+#include "work_pool.h"
 
-struct TreeNode {
-  int id, parent;
+// Marks a missing node in the node arrays.
+#define NO_NODE (-1)
 
-  struct List *preferences;
-  struct List *childs;
+// Result of a marathon from a node, kept for the next queries. It holds the
+// [k] greatest values greater than [limit] in the subtree of the node, or all
+// of them if there are less.
+struct MarathonCache {
+  // Value of [generation] of the nodes when the result was stored.
+  int64_t generation;
 
-  // Position in the child list of the parent node, for O(1) node deletion.
-  struct ListNode *pos_in_childlist;
+  int32_t limit, k, size;
+  int32_t values[];
 };
 
-// Free the given node and all its childs.
-static void freeTreeNode(struct Tree tree, int node_id) {
-  struct TreeNode *tree_node = tree.nodes[node_id];
-  assert(tree_node);
-  listForeach(tree_node->childs, curr, { freeTreeNode(tree, curr->value); });
+// Bytes taken by a cached result of [size] values.
+#define marathonCacheSize(size)                                                \
+  (sizeof(struct MarathonCache) + sizeof(int32_t) * (size))
 
-  listFree(tree_node->preferences);
-  listFree(tree_node->childs);
-  free(tree_node);
-  tree.nodes[node_id] = NULL;
+// Nodes of the tree. They are kept in dense slots [0, count), the root always
+// in slot 0. Slots are internal and change when the nodes are moved, users
+// are known by their ids. Node arrays are indexed by slots and link slots.
+struct TreeNodes {
+  // Allocator of the preference values and the cached results, the one of the
+  // tree. Views have none, they never allocate.
+  struct SlabAllocator *allocator;
+
+  // Slot of every user id.
+  struct IdMap slot_of;
+
+  // Id of the node in every slot.
+  int32_t *id_of;
+
+  // Number of used slots, and the number of slots the arrays have room for.
+  // There is one more slot past [capacity], used when two nodes swap slots.
+  int32_t count, capacity;
+
+  // Group of the parent that every node belongs to, see [ParentGroups], and
+  // the group of its own childs. User 0 belongs to no group.
+  int32_t *group, *own_group;
+  struct ParentGroups groups;
+
+  // Ends of the child list of every node, and neighbours of every node in the
+  // child list of its parent.
+  int32_t *first_child, *last_child;
+  int32_t *next_sibling, *prev_sibling;
+
+  // Upper bound of the preferences in the whole subtree of every node, -1 if
+  // there are none. It is at least the max preference of the node and the
+  // bound of each of its childs. Deleting a node or a preference does not
+  // lower the bounds of the ancestors, so they may be too high until the
+  // compaction recomputes them; they are only used to skip subtrees.
+  int32_t *subtree_max;
+
+  struct SortedArray *preferences;
+
+  // Cached marathon result of every node, NULL if there is none.
+  struct MarathonCache **cache;
+
+  // [generation] in which the preferences in the subtree of every node last
+  // changed. A cached result is valid if it is newer than that.
+  int64_t *stamp;
+
+  // Incremented whenever a result is cached. A change of the preferences
+  // stamps the node and its ancestors, but stops at the first one already
+  // stamped in the current generation: all of its ancestors are stamped too.
+  // So a change costs at most the depth of the node, and usually much less.
+  int64_t generation;
+
+  // State of the compaction, which moves the nodes so that they are stored in
+  // pre-order. Slots [0, compact_position) hold the nodes already placed,
+  // [compact_next] is the id of the next one. When the last placed node has no
+  // childs, the compaction climbs up from it to find the next one instead:
+  // [compact_leaving] is the id of the node whose subtree is placed. Both are
+  // [NO_NODE] if the compaction is not running.
+  int32_t compact_position, compact_next, compact_leaving;
+
+  // A node is left only after all of its childs, so its [subtree_max] is
+  // recomputed from theirs then. [compact_child] is the id of the next child
+  // to look at, or [NO_NODE] if there are no more, and [compact_max] is the
+  // max of their bounds so far.
+  int32_t compact_child, compact_max;
+
+  // Nodes added and deleted, and preferences removed, since the last
+  // compaction started.
+  int32_t changes;
+
+  // File the tree was loaded from, if any. Preferences that did not change
+  // since then are still read from it.
+  struct Snapshot snapshot;
+
+  // Views of the tree read by marathons on other threads, see [treeViewTake].
+  // [view] shares the arrays of the tree as it is now, it is NULL if the tree
+  // changed since the last view was taken. [epoch] is the number of the last
+  // view, and views older than [released] are no longer read.
+  struct TreeNodes *view;
+  uint64_t epoch, released;
+
+  // [epoch] in which the preference buffer of every slot was made. Only the
+  // views taken after it can read the buffer.
+  uint64_t *pref_epoch;
+
+  // Memory the tree no longer uses, but views may still read. It is freed in
+  // the order it was retired, see [treeViewsRelease].
+  struct TreeRetired *retired;
+  int32_t retired_begin, retired_end, retired_capacity;
+};
+
+// Memory left to the views up to [epoch]: a view with its own node arrays, or
+// the [values] of preferences if [view] is NULL.
+struct TreeRetired {
+  uint64_t epoch;
+  struct TreeNodes *view;
+  struct SortedArray values;
+};
+
+// Number of slots of an empty tree. The node arrays double when they are full.
+#define TREE_INITIAL_CAPACITY (1024)
+
+// Units of the compaction done during a single tree operation, see
+// [treeCompactStep].
+#define COMPACT_STEP_BUDGET (64)
+
+// The compaction starts after this many changes, for every node.
+#define COMPACT_CHANGES_RATIO (4)
+
+// Sorted (NON-INCREASING) sequence of values stored in the scratch arena.
+struct Run {
+  int64_t offset;
+  int32_t size;
+};
+
+// State of the marathon computation for a single node.
+struct MarathonFrame {
+  int32_t max_value, next_limit;
+
+  // Childs only have to look for values greater than this. It starts as
+  // [next_limit] and is raised to the k-th best value found so far, because
+  // nothing below it can get to the final result.
+  int32_t bound;
+
+  // Result of the node. Until the node is left, this is where the results of
+  // its childs start.
+  struct Run res;
+
+  // Child results waiting for the k-way merge.
+  int64_t sizes_offset, total_size;
+  int32_t child_count;
+};
+
+// One level of the explicit traversal stack.
+struct TraversalFrame {
+  int32_t node;
+
+  // Next child to visit, [NO_NODE] when all of them were visited.
+  int32_t next_child;
+
+  struct MarathonFrame marathon;
+};
+
+// Called when the traversal reaches [frame->node]. [parent] is NULL for the
+// root of the traversal. If 0 is returned, the subtree of the node is skipped
+// and [traversal_leave] is not called for it.
+typedef int (*traversal_enter)(const struct Tree *tree,
+                               struct TraversalFrame *frame,
+                               struct TraversalFrame *parent, void *context);
+
+// Called after the whole subtree of [frame->node] was visited.
+typedef void (*traversal_leave)(const struct Tree *tree,
+                                struct TraversalFrame *frame,
+                                struct TraversalFrame *parent, void *context);
+
+// Memory reused by all traversals and marathon queries on a tree.
+// Entry of the frontier of a lazy marathon. It is either a node whose subtree
+// was not visited yet, keyed by the maximum of the subtree, or the next
+// preference of a visited node, keyed by its value.
+struct FrontierEntry {
+  int32_t key;
+  int32_t node;
+
+  // Index of the preference, [NO_NODE] for a node that was not visited.
+  int32_t index;
+
+  // Values of the node must be greater than this to get to the result.
+  int32_t limit;
+};
+
+// Marathons for at most this many values keep their result in a fixed array.
+#define MARATHON_SMALL_K (16)
+
+// Best values found so far by a marathon for a small k, in descending order.
+// Free places hold -1, which is smaller than every movie.
+struct SmallMarathon {
+  int32_t top[MARATHON_SMALL_K];
+  int32_t k;
+};
+
+struct MarathonIter {
+  struct TreeNodes *nodes;
+  int32_t root;
+
+  // Max-heap of the entries that can still give values.
+  struct FrontierEntry *frontier;
+  int32_t frontier_size, frontier_capacity;
+
+  // Values known before the frontier is used: a result cached in the root, or
+  // one found with [struct SmallMarathon]. They are all the values if there
+  // are less than [head_k] of them.
+  const int32_t *head;
+  int32_t head_size, head_k, head_index;
+  struct SmallMarathon small;
+
+  // Last returned value, values not smaller than it are skipped.
+  int64_t last;
+
+  // Number of returned values, and 1 if there are no more of them.
+  int32_t pulled;
+  int done;
+
+  // Values returned so far are kept in [record], so they can be cached in the
+  // root when the iterator ends. [cache_k] limits their number.
+  struct ScratchArena *record;
+  int32_t cache_k;
+  int recording;
+};
+
+struct TreeScratch {
+  // Traversal stack. It only grows, so deep trees reallocate it just once.
+  struct TraversalFrame *frames;
+  int32_t frames_capacity;
+
+  // Results computed so far, see [struct Run].
+  struct ScratchArena *values;
+
+  // Sizes of the child results waiting for the k-way merge.
+  struct ScratchArena *run_sizes;
+
+  struct MergeScratch merge;
+
+  // The only iterator, so its frontier is allocated just once.
+  struct MarathonIter iter;
+};
+
+// Initial capacity of the traversal stack.
+#define TRAVERSAL_INITIAL_DEPTH (1024)
+
+// Change the size of a node array to [count] values. Aborts with error code 1
+// if could not allocate memory.
+#define treeArrayResize(array, count)                                          \
+  ({                                                                           \
+    void *__resized = realloc((array), sizeof(*(array)) * (count));            \
+    if (!__resized)                                                            \
+      exit(1);                                                                 \
+    (array) = __resized;                                                       \
+  })
+
+// Make room for [capacity] slots, and the spare one, in all node arrays.
+static void treeNodesResize(struct TreeNodes *nodes, int32_t capacity) {
+  assert(capacity >= nodes->count);
+
+  treeArrayResize(nodes->id_of, capacity + 1);
+  treeArrayResize(nodes->group, capacity + 1);
+  treeArrayResize(nodes->own_group, capacity + 1);
+  treeArrayResize(nodes->first_child, capacity + 1);
+  treeArrayResize(nodes->last_child, capacity + 1);
+  treeArrayResize(nodes->next_sibling, capacity + 1);
+  treeArrayResize(nodes->prev_sibling, capacity + 1);
+  treeArrayResize(nodes->subtree_max, capacity + 1);
+  treeArrayResize(nodes->preferences, capacity + 1);
+  treeArrayResize(nodes->cache, capacity + 1);
+  treeArrayResize(nodes->stamp, capacity + 1);
+  treeArrayResize(nodes->pref_epoch, capacity + 1);
+  nodes->capacity = capacity;
 }
 
-struct Tree initTree(int32_t number_of_nodes) {
-  struct TreeNode **tree_nodes =
-      malloc(sizeof(struct TreeNode *) * number_of_nodes);
-  if (!tree_nodes)
+struct TreeScratch *treeScratchCreate(void) {
+  struct TreeScratch *scratch = malloc(sizeof(struct TreeScratch));
+  struct TraversalFrame *frames =
+      malloc(sizeof(struct TraversalFrame) * TRAVERSAL_INITIAL_DEPTH);
+  if (!scratch || !frames)
     exit(1);
 
-  // Clear the allocatted array.
-  memset(tree_nodes, 0, sizeof(struct TreeNode *) * number_of_nodes);
+  (*scratch) = (struct TreeScratch){frames, TRAVERSAL_INITIAL_DEPTH,
+                                    arenaCreate(), arenaCreate(),
+                                    (struct MergeScratch){NULL, NULL, 0},
+                                    (struct MarathonIter){.frontier = NULL}};
+  return scratch;
+}
+
+void treeScratchDestroy(struct TreeScratch *scratch) {
+  free(scratch->frames);
+  arenaDestroy(scratch->values);
+  arenaDestroy(scratch->run_sizes);
+  mergeScratchFree(&scratch->merge);
+  free(scratch->iter.frontier);
+  free(scratch);
+}
+
+// Initialize [nodes] with room for [capacity] slots, but no nodes and no id
+// map. Values and results are allocated from [alloc]. Aborts with error code 1
+// if could not allocate memory.
+static void treeNodesCreate(struct TreeNodes *nodes,
+                            struct SlabAllocator *alloc, int32_t capacity) {
+  (*nodes) = (struct TreeNodes){.allocator = alloc,
+                                .id_of = NULL,
+                                .group = NULL,
+                                .own_group = NULL,
+                                .first_child = NULL,
+                                .last_child = NULL,
+                                .next_sibling = NULL,
+                                .prev_sibling = NULL,
+                                .subtree_max = NULL,
+                                .preferences = NULL,
+                                .cache = NULL,
+                                .stamp = NULL,
+                                .compact_next = NO_NODE,
+                                .compact_leaving = NO_NODE,
+                                .compact_child = NO_NODE,
+                                .snapshot = {NULL, 0, 0},
+                                .view = NULL,
+                                .epoch = 0,
+                                .released = 1,
+                                .pref_epoch = NULL,
+                                .retired = NULL};
+  groupsInit(&nodes->groups);
+  treeNodesResize(nodes, capacity);
+}
+
+// Free a view and the arrays it does not share with the tree, or the retired
+// preferences.
+static void treeRetiredFree(struct TreeNodes *nodes,
+                            struct TreeRetired *retired) {
+  if (retired->view) {
+    free(retired->view->first_child);
+    free(retired->view->next_sibling);
+    free(retired->view->subtree_max);
+    free(retired->view->preferences);
+    free(retired->view);
+  }
+
+  sortedArrayFree(nodes->allocator, &retired->values);
+}
+
+// Free the cached result of [slot], if there is one.
+static void treeFreeCache(struct TreeNodes *nodes, int32_t slot) {
+  struct MarathonCache *cache = nodes->cache[slot];
+  if (cache)
+    slabFreeBuffer(nodes->allocator, cache, marathonCacheSize(cache->size));
+
+  nodes->cache[slot] = NULL;
+}
+
+// Free everything [nodes] hold, but not the struct itself. No view of them
+// may be read anymore.
+static void treeNodesFree(struct TreeNodes *nodes) {
+  for (int32_t i = nodes->retired_begin; i < nodes->retired_end; ++i)
+    treeRetiredFree(nodes, &nodes->retired[i]);
+
+  free(nodes->retired);
+  free(nodes->view);
+
+  for (int32_t i = 0; i < nodes->count; ++i) {
+    sortedArrayFree(nodes->allocator, &nodes->preferences[i]);
+    treeFreeCache(nodes, i);
+  }
 
-  // Add user 0.
-  struct TreeNode *root = malloc(sizeof(struct TreeNode));
-  struct List *childs = malloc(sizeof(struct List));
-  struct List *preferences = malloc(sizeof(struct List));
-  if (!root || !childs || !preferences)
+  idMapFree(&nodes->slot_of);
+  free(nodes->id_of);
+  free(nodes->group);
+  free(nodes->own_group);
+  groupsFree(&nodes->groups);
+  free(nodes->first_child);
+  free(nodes->last_child);
+  free(nodes->next_sibling);
+  free(nodes->prev_sibling);
+  free(nodes->subtree_max);
+  free(nodes->preferences);
+  free(nodes->cache);
+  free(nodes->stamp);
+  free(nodes->pref_epoch);
+  snapshotClose(&nodes->snapshot);
+}
+
+struct Tree initTree(void) {
+  struct TreeNodes *nodes = malloc(sizeof(struct TreeNodes));
+  if (!nodes)
     exit(1);
 
-  (*childs) = (struct List){NULL, NULL};
-  (*preferences) = (struct List){NULL, NULL};
-  (*root) = (struct TreeNode){0, 0, preferences, childs, NULL};
+  // The result lists of [runMarathon] come from the object classes of the
+  // slabs, the preference values and the cached results from the buffers.
+  const size_t object_sizes[SLAB_OBJECT_CLASS_COUNT] = {
+      [SLAB_LIST_NODE] = sizeof(struct ListNode),
+      [SLAB_LIST] = sizeof(struct List)};
+  struct SlabAllocator *alloc = slabCreate(object_sizes, SLAB_USE_HUGE_PAGES);
 
-  tree_nodes[0] = root;
+  treeNodesCreate(nodes, alloc, TREE_INITIAL_CAPACITY);
+  idMapInit(&nodes->slot_of);
 
-  struct Tree res = {tree_nodes, number_of_nodes};
+  // Add user 0. It is the only node without a parent.
+  idMapSet(&nodes->slot_of, 0, 0);
+  nodes->id_of[0] = 0;
+  nodes->group[0] = NO_NODE;
+  nodes->own_group[0] = groupCreate(&nodes->groups, 0);
+  nodes->first_child[0] = nodes->last_child[0] = NO_NODE;
+  nodes->next_sibling[0] = nodes->prev_sibling[0] = NO_NODE;
+  nodes->subtree_max[0] = -1;
+  sortedArrayInit(&nodes->preferences[0]);
+  nodes->cache[0] = NULL;
+  nodes->stamp[0] = 0;
+  nodes->pref_epoch[0] = 0;
+  nodes->count = 1;
+
+  struct Tree res = {nodes, alloc, treeScratchCreate(), MARATHON_MERGE_HEAP,
+                     MARATHON_DEFAULT_CACHE_K, NULL};
   return res;
 }
 
 void freeTree(struct Tree tree) {
-  freeTreeNode(tree, 0);
+  treeScratchDestroy(tree.scratch);
+  treeSetThreads(&tree, 1);
+
+  treeNodesFree(tree.nodes);
   free(tree.nodes);
+  slabDestroy(tree.allocator);
+}
+
+// Slot of the user [id], or [NO_NODE] if there is no such user.
+static int32_t treeSlot(const struct TreeNodes *nodes, int id) {
+  if (id < 0)
+    return NO_NODE;
 
-  tree.nodes = NULL;
+  return idMapGet(&nodes->slot_of, id);
 }
 
-int treeAddNode(struct Tree tree, int id, int parent) {
-  if (!inRange(0, tree.size, id) || !inRange(0, tree.size, parent))
-    return 0;
+// Check if a view that may still be read was taken after [epoch], so it can
+// read the memory the tree had then.
+static int treeViewsMayRead(const struct TreeNodes *nodes, uint64_t epoch) {
+  return nodes->epoch > epoch && nodes->epoch >= nodes->released;
+}
 
-  // If node to add already exits, or parent does not:
-  if (tree.nodes[id] || !tree.nodes[parent])
-    return 0;
+// Leave a [view] or the [values] of preferences to the views that may still
+// read them. Aborts with error code 1 if could not allocate memory.
+static void treeRetire(struct TreeNodes *nodes, struct TreeNodes *view,
+                       struct SortedArray values) {
+  if (nodes->retired_end == nodes->retired_capacity) {
+    int32_t begin = nodes->retired_begin;
+    if (begin > 0) {
+      memmove(nodes->retired, nodes->retired + begin,
+              sizeof(struct TreeRetired) * (nodes->retired_end - begin));
+      nodes->retired_begin = 0;
+      nodes->retired_end -= begin;
+    } else {
+      int32_t new_capacity = MAX(2 * nodes->retired_capacity, 64);
+      treeArrayResize(nodes->retired, new_capacity);
+      nodes->retired_capacity = new_capacity;
+    }
+  }
+
+  nodes->retired[nodes->retired_end++] =
+      (struct TreeRetired){nodes->epoch, view, values};
+}
 
-  struct TreeNode *new_node = malloc(sizeof(struct TreeNode)),
-                  *parent_node = tree.nodes[parent];
+// Copy the node array [array] of [count] values, so the old one can be left to
+// a view. Aborts with error code 1 if could not allocate memory.
+#define treeArrayCopy(array, count)                                            \
+  ({                                                                           \
+    void *__copy = malloc(sizeof(*(array)) * (count));                         \
+    if (!__copy)                                                               \
+      exit(1);                                                                 \
+    memcpy(__copy, (array), sizeof(*(array)) * (count));                       \
+    (array) = __copy;                                                          \
+  })
 
-  if (!new_node)
-    exit(1);
+// Let the tree change the arrays that views read. If the last view may still
+// be read, the arrays are copied and the view keeps the old ones. Must be
+// called before any change of the nodes. Aborts with error code 1 if could not
+// allocate memory.
+static void treeUnshare(struct TreeNodes *nodes) {
+  struct TreeNodes *view = nodes->view;
+  if (!view)
+    return;
+
+  nodes->view = NULL;
+  if (!treeViewsMayRead(nodes, nodes->epoch - 1)) {
+    free(view);
+    return;
+  }
+
+  treeArrayCopy(nodes->first_child, nodes->capacity + 1);
+  treeArrayCopy(nodes->next_sibling, nodes->capacity + 1);
+  treeArrayCopy(nodes->subtree_max, nodes->capacity + 1);
+  treeArrayCopy(nodes->preferences, nodes->capacity + 1);
+  treeRetire(nodes, view, (struct SortedArray){NULL, 0, 0});
+}
+
+// Let the tree change the preferences of [slot]. Values that views may still
+// read are copied, and the views keep the old ones. Aborts with error code 1
+// if could not allocate memory.
+static void treeOwnPreferences(struct TreeNodes *nodes, int32_t slot) {
+  struct SortedArray *prefs = &nodes->preferences[slot];
+  if (prefs->capacity > 0 && treeViewsMayRead(nodes, nodes->pref_epoch[slot])) {
+    treeRetire(nodes, NULL, *prefs);
+    sortedArrayUnshare(nodes->allocator, prefs);
+  }
+
+  // Values allocated from now on are not in any view.
+  nodes->pref_epoch[slot] = nodes->epoch;
+}
+
+// Free the preferences of [slot], or leave them to the views that may still
+// read them.
+static void treeFreePreferences(struct TreeNodes *nodes, int32_t slot) {
+  struct SortedArray *prefs = &nodes->preferences[slot];
+  if (prefs->capacity > 0 && treeViewsMayRead(nodes, nodes->pref_epoch[slot])) {
+    treeRetire(nodes, NULL, *prefs);
+    sortedArrayInit(prefs);
+  } else {
+    sortedArrayFree(nodes->allocator, prefs);
+  }
+}
+
+uint64_t treeViewTake(struct Tree tree, struct Tree *view) {
+  struct TreeNodes *nodes = tree.nodes;
+  if (!nodes->view) {
+    struct TreeNodes *shared = malloc(sizeof(struct TreeNodes));
+    if (!shared)
+      exit(1);
+
+    // Marathons only read these arrays. There is no cache, it belongs to the
+    // tree.
+    (*shared) = (struct TreeNodes){.count = nodes->count,
+                                   .capacity = nodes->capacity,
+                                   .first_child = nodes->first_child,
+                                   .next_sibling = nodes->next_sibling,
+                                   .subtree_max = nodes->subtree_max,
+                                   .preferences = nodes->preferences,
+                                   .cache = NULL,
+                                   .compact_next = NO_NODE,
+                                   .compact_leaving = NO_NODE,
+                                   .compact_child = NO_NODE};
+    nodes->view = shared;
+    ++nodes->epoch;
+  } else if (nodes->epoch < nodes->released) {
+    // The view was released already, it is read again in a new epoch.
+    ++nodes->epoch;
+  }
+
+  (*view) =
+      (struct Tree){nodes->view, NULL, NULL, tree.merge, 0, tree.parallel};
+  return nodes->epoch;
+}
+
+void treeViewsRelease(struct Tree tree, uint64_t epoch) {
+  struct TreeNodes *nodes = tree.nodes;
+
+  // Views taken later are read until they are released too.
+  epoch = MIN(epoch, nodes->epoch + 1);
+  nodes->released = MAX(nodes->released, epoch);
+  while (nodes->retired_begin < nodes->retired_end &&
+         nodes->retired[nodes->retired_begin].epoch < nodes->released)
+    treeRetiredFree(nodes, &nodes->retired[nodes->retired_begin++]);
+
+  if (nodes->retired_begin == nodes->retired_end)
+    nodes->retired_begin = nodes->retired_end = 0;
+}
+
+int32_t treeViewNode(struct Tree tree, int id) {
+  return treeSlot(tree.nodes, id);
+}
+
+// Slot of the parent of [slot], which must not be 0. The node is pointed
+// straight to the root group of its parent, so the next lookup is faster.
+static int32_t treeParent(struct TreeNodes *nodes, int32_t slot) {
+  assert(slot != 0);
+  int32_t group = nodes->group[slot];
+  int32_t root = groupFind(&nodes->groups, group);
+  if (root != group) {
+    groupAcquire(&nodes->groups, root);
+    groupRelease(&nodes->groups, group);
+    nodes->group[slot] = root;
+  }
+
+  return groupOwner(&nodes->groups, root);
+}
+
+// Move the node from slot [from] to the free slot [to], and fix all the links
+// to it. Childs find their parent through its group, so they are not visited.
+static void treeMoveNode(struct TreeNodes *nodes, int32_t from, int32_t to) {
+  assert(from != 0 && to != 0 && from != to);
+
+  int32_t parent = treeParent(nodes, from);
+  nodes->group[to] = nodes->group[from];
+  nodes->own_group[to] = nodes->own_group[from];
+  groupOwner(&nodes->groups, nodes->own_group[to]) = to;
+  int32_t prev = nodes->prev_sibling[to] = nodes->prev_sibling[from];
+  int32_t next = nodes->next_sibling[to] = nodes->next_sibling[from];
+  nodes->first_child[to] = nodes->first_child[from];
+  nodes->last_child[to] = nodes->last_child[from];
+  nodes->subtree_max[to] = nodes->subtree_max[from];
+  nodes->preferences[to] = nodes->preferences[from];
+  nodes->cache[to] = nodes->cache[from];
+  nodes->stamp[to] = nodes->stamp[from];
+  nodes->pref_epoch[to] = nodes->pref_epoch[from];
+  nodes->id_of[to] = nodes->id_of[from];
+  idMapSet(&nodes->slot_of, nodes->id_of[to], to);
+
+  if (prev != NO_NODE)
+    nodes->next_sibling[prev] = to;
+  else
+    nodes->first_child[parent] = to;
+
+  if (next != NO_NODE)
+    nodes->prev_sibling[next] = to;
+  else
+    nodes->last_child[parent] = to;
+}
+
+// Exchange the slots of two nodes, through the spare slot.
+static void treeSwapNodes(struct TreeNodes *nodes, int32_t first,
+                          int32_t second) {
+  int32_t spare = nodes->capacity;
+  treeMoveNode(nodes, first, spare);
+  treeMoveNode(nodes, second, first);
+  treeMoveNode(nodes, spare, second);
+}
+
+// 1 if the compaction is running.
+static int treeCompactRunning(const struct TreeNodes *nodes) {
+  return nodes->compact_next != NO_NODE || nodes->compact_leaving != NO_NODE;
+}
+
+// Start leaving the node in [slot], whose subtree is placed.
+static void treeCompactLeave(struct TreeNodes *nodes, int32_t slot) {
+  int32_t child = nodes->first_child[slot];
+  nodes->compact_leaving = nodes->id_of[slot];
+  nodes->compact_child = child == NO_NODE ? NO_NODE : nodes->id_of[child];
+  nodes->compact_max = -1;
+}
+
+// Do at most [budget] units of the compaction, if it is running. A unit either
+// moves one node to its pre-order slot, takes the bound of one child of the
+// node left, or climbs one level up from it. Every node is placed once, looked
+// at as a child once and left once, so the whole compaction is linear, and a
+// single step costs O([budget]) whatever the shape of the tree.
+static void treeCompactStep(struct TreeNodes *nodes, int32_t budget) {
+  for (; budget > 0 && treeCompactRunning(nodes); --budget) {
+    if (nodes->compact_child != NO_NODE) {
+      int32_t child = idMapGet(&nodes->slot_of, nodes->compact_child);
+      int32_t next = nodes->next_sibling[child];
+      nodes->compact_max = MAX(nodes->compact_max, nodes->subtree_max[child]);
+      nodes->compact_child = next == NO_NODE ? NO_NODE : nodes->id_of[next];
+      continue;
+    }
 
-  tree.nodes[id] = new_node;
+    if (nodes->compact_leaving != NO_NODE) {
+      // All the childs are seen, the bound is exact for them.
+      int32_t slot = idMapGet(&nodes->slot_of, nodes->compact_leaving);
+      nodes->subtree_max[slot] =
+          MAX(nodes->compact_max, sortedArrayMax(&nodes->preferences[slot]));
+
+      // The next node in pre-order is the next sibling of the node left, or of
+      // its closest ancestor that has one.
+      int32_t next = nodes->next_sibling[slot];
+      if (next != NO_NODE) {
+        nodes->compact_next = nodes->id_of[next];
+        nodes->compact_leaving = NO_NODE;
+      } else if (slot == 0) {
+        nodes->compact_leaving = NO_NODE;
+      } else {
+        treeCompactLeave(nodes, treeParent(nodes, slot));
+      }
+
+      continue;
+    }
+
+    int32_t position = nodes->compact_position;
+
+    // Nodes were deleted behind the compaction, the rest is in place.
+    if (position >= nodes->count) {
+      nodes->compact_next = NO_NODE;
+      break;
+    }
+
+    int32_t curr = idMapGet(&nodes->slot_of, nodes->compact_next);
+    if (curr != position)
+      treeSwapNodes(nodes, curr, position);
+
+    nodes->compact_position = position + 1;
+    int32_t child = nodes->first_child[position];
+    if (child != NO_NODE) {
+      nodes->compact_next = nodes->id_of[child];
+    } else {
+      nodes->compact_next = NO_NODE;
+      treeCompactLeave(nodes, position);
+    }
+  }
+}
+
+// Start the compaction from the root.
+static void treeCompactStart(struct TreeNodes *nodes) {
+  nodes->compact_position = 0;
+  nodes->compact_next = 0;
+  nodes->compact_leaving = nodes->compact_child = NO_NODE;
+  nodes->changes = 0;
+}
 
 #ifdef DEBUG
-  assert(!listRemoveElement(parent_node->childs, id));
+
+// Check that the slot maps, links and subtree maximums of all the used slots
+// agree.
+static int treeNodesAreValid(const struct TreeNodes *nodes) {
+  for (int32_t slot = 0; slot < nodes->count; ++slot) {
+    if (idMapGet(&nodes->slot_of, nodes->id_of[slot]) != slot)
+      return 0;
+
+    int32_t prev = NO_NODE;
+    int32_t subtree_max = sortedArrayMax(&nodes->preferences[slot]);
+    for (int32_t child = nodes->first_child[slot]; child != NO_NODE;
+         child = nodes->next_sibling[child]) {
+      int32_t parent_group = groupFind(&nodes->groups, nodes->group[child]);
+      if (child >= nodes->count ||
+          groupOwner(&nodes->groups, parent_group) != slot ||
+          nodes->prev_sibling[child] != prev)
+        return 0;
+
+      prev = child;
+      subtree_max = MAX(subtree_max, nodes->subtree_max[child]);
+    }
+
+    if (nodes->last_child[slot] != prev ||
+        nodes->subtree_max[slot] < subtree_max)
+      return 0;
+  }
+
+  return 1;
+}
+
 #endif
 
-  struct List *childs = malloc(sizeof(struct List));
-  struct List *prefs = malloc(sizeof(struct List));
-  if (!childs || !prefs)
-    exit(1);
+// Count a change, and start the compaction if there were enough of them for
+// the nodes to be scattered or the bounds to be loose. Then do the next part
+// of it.
+static void treeCompactAfterChange(struct TreeNodes *nodes) {
+#ifdef DEBUG
+  assert(treeNodesAreValid(nodes));
+#endif
+
+  nodes->changes++;
+  if (!treeCompactRunning(nodes) &&
+      nodes->changes > nodes->count / COMPACT_CHANGES_RATIO)
+    treeCompactStart(nodes);
+
+  treeCompactStep(nodes, COMPACT_STEP_BUDGET);
+}
+
+void treeCompact(struct Tree tree) {
+  treeUnshare(tree.nodes);
+  if (!treeCompactRunning(tree.nodes))
+    treeCompactStart(tree.nodes);
+
+  treeCompactStep(tree.nodes, INT32_MAX);
+}
+
+int32_t treeSubtreeBound(struct Tree tree, int id) {
+  int32_t slot = treeSlot(tree.nodes, id);
+  return slot == NO_NODE ? -1 : tree.nodes->subtree_max[slot];
+}
+
+// Mark that the preferences in the subtree of [slot] have changed, so the
+// results cached at the node and its ancestors are no longer valid.
+static void treeInvalidate(struct TreeNodes *nodes, int32_t slot) {
+  while (nodes->stamp[slot] != nodes->generation) {
+    nodes->stamp[slot] = nodes->generation;
+    if (slot == 0)
+      break;
+
+    slot = treeParent(nodes, slot);
+  }
+}
+
+int treeAddNode(struct Tree tree, int id, int parent) {
+  struct TreeNodes *nodes = tree.nodes;
+
+  // If node to add already exits, or parent does not:
+  int32_t parent_slot = treeSlot(nodes, parent);
+  if (id < 0 || treeSlot(nodes, id) != NO_NODE || parent_slot == NO_NODE)
+    return 0;
 
-  (*childs) = (struct List){NULL, NULL};
-  (*prefs) = (struct List){NULL, NULL};
+  treeUnshare(nodes);
+  if (nodes->count == nodes->capacity)
+    treeNodesResize(nodes, 2 * nodes->capacity);
 
-  // After a push back [parent_node->childs->tail] point to the correct node.
-  listPushBack(parent_node->childs, id);
-  (*new_node) =
-      (struct TreeNode){id, parent, prefs, childs, parent_node->childs->tail};
+  // The new node takes the first free slot and goes to the end of the child
+  // list of the parent.
+  int32_t slot = nodes->count++;
+  int32_t last = nodes->last_child[parent_slot];
+  idMapSet(&nodes->slot_of, id, slot);
+  nodes->id_of[slot] = id;
+  nodes->group[slot] = nodes->own_group[parent_slot];
+  groupAcquire(&nodes->groups, nodes->group[slot]);
+  nodes->own_group[slot] = groupCreate(&nodes->groups, slot);
+  nodes->prev_sibling[slot] = last;
+  nodes->next_sibling[slot] = NO_NODE;
+  nodes->first_child[slot] = nodes->last_child[slot] = NO_NODE;
+  nodes->subtree_max[slot] = -1;
+  sortedArrayInit(&nodes->preferences[slot]);
+  nodes->cache[slot] = NULL;
+  nodes->stamp[slot] = 0;
+  nodes->pref_epoch[slot] = nodes->epoch;
 
+  if (last != NO_NODE)
+    nodes->next_sibling[last] = slot;
+  else
+    nodes->first_child[parent_slot] = slot;
+  nodes->last_child[parent_slot] = slot;
+
+  treeCompactAfterChange(nodes);
   return 1;
 }
 
 int treeDelNode(struct Tree tree, int id) {
-  if (!inRange(0, tree.size, id))
-    return 0;
+  struct TreeNodes *nodes = tree.nodes;
 
   // It is neither possible to remove root user, nor the node that isnt there.
-  if (id == 0 || !tree.nodes[id])
+  int32_t slot = treeSlot(nodes, id);
+  if (id == 0 || slot == NO_NODE)
     return 0;
 
-  struct TreeNode *node_to_delete = tree.nodes[id];
-  struct TreeNode *parent = tree.nodes[node_to_delete->parent];
-  assert(parent);
+  treeUnshare(nodes);
+  int32_t parent = treeParent(nodes, slot);
 
-  listForeach(node_to_delete->childs, node,
-              { tree.nodes[node->value]->parent = parent->id; });
+  // Now we remove the node from the list, so is is not there anymore.
+  int32_t prev = nodes->prev_sibling[slot], next = nodes->next_sibling[slot];
+  if (prev != NO_NODE)
+    nodes->next_sibling[prev] = next;
+  else
+    nodes->first_child[parent] = next;
 
-  // Free the preferences list.
-  listFree(node_to_delete->preferences);
+  if (next != NO_NODE)
+    nodes->prev_sibling[next] = prev;
+  else
+    nodes->last_child[parent] = prev;
 
-  assert(node_to_delete->pos_in_childlist->value == node_to_delete->id);
+  // The childlist of the deleted node is appended to its parent.
+  int32_t first = nodes->first_child[slot], last = nodes->last_child[parent];
+  if (first != NO_NODE) {
+    nodes->prev_sibling[first] = last;
+    if (last != NO_NODE)
+      nodes->next_sibling[last] = first;
+    else
+      nodes->first_child[parent] = first;
 
-  // Now we remove the node from the list, so is is not there anymore.
-  listRemoveNode(parent->childs, node_to_delete->pos_in_childlist);
-#ifdef DEBUG
-  assert(!listRemoveElement(parent->childs, node_to_delete->id));
-#endif
+    nodes->last_child[parent] = nodes->last_child[slot];
+  }
 
-  // The childlist of the deleted node is appended to its parent.
-  listConcat(tree.nodes[node_to_delete->parent]->childs,
-             node_to_delete->childs);
+  // All the childs get the new parent at once.
+  nodes->own_group[parent] = groupMerge(
+      &nodes->groups, nodes->own_group[parent], nodes->own_group[slot]);
+  groupRelease(&nodes->groups, nodes->group[slot]);
+
+  // Free the preferences, and the results that counted them.
+  treeFreePreferences(nodes, slot);
+  treeFreeCache(nodes, slot);
+  treeInvalidate(nodes, parent);
+
+  idMapRemove(&nodes->slot_of, id);
+
+  // The maximum of the parent subtree may have been a preference of the
+  // deleted node. It is not recomputed, as that would visit all the childs of
+  // the parent; an upper bound is enough until the compaction, see
+  // [subtree_max].
+
+  // The last node fills the hole, so the used slots stay dense.
+  int32_t moved = --nodes->count;
+  if (slot != moved)
+    treeMoveNode(nodes, moved, slot);
 
-  free(node_to_delete->childs);
-  free(node_to_delete);
-  tree.nodes[id] = NULL;
+  // The compaction cannot go on from a node that is gone. If the node was
+  // already placed, which includes the one it climbs from, its childs moved to
+  // the end of the parent childlist and the last node took its slot, so the
+  // placed part is no longer in pre-order and it starts again.
+  if (nodes->compact_next == id || nodes->compact_child == id ||
+      (treeCompactRunning(nodes) && slot < nodes->compact_position))
+    treeCompactStart(nodes);
 
+  treeCompactAfterChange(nodes);
   return 1;
 }
 
 int treeAddPreference(struct Tree tree, int id, int32_t value) {
-  if (!tree.nodes[id] || value < 0)
+  struct TreeNodes *nodes = tree.nodes;
+  int32_t curr = treeSlot(nodes, id);
+  if (curr == NO_NODE || value < 0)
     return 0;
 
-  return listInsertMaintainSortOrder(tree.nodes[id]->preferences, value);
+  treeUnshare(nodes);
+  treeOwnPreferences(nodes, curr);
+  if (!sortedArrayInsert(nodes->allocator, &nodes->preferences[curr], value))
+    return 0;
+
+  treeInvalidate(nodes, curr);
+
+  // Raise the maximum of every ancestor subtree that is smaller than [value].
+  // The node the compaction leaves gets its bound from the childs it has seen,
+  // so they must count [value] too if it is in its subtree.
+  for (;; curr = treeParent(nodes, curr)) {
+    if (nodes->id_of[curr] == nodes->compact_leaving)
+      nodes->compact_max = MAX(nodes->compact_max, value);
+
+    if (nodes->subtree_max[curr] >= value)
+      break;
+
+    nodes->subtree_max[curr] = value;
+    if (curr == 0)
+      break;
+  }
+
+  return 1;
 }
 
 int treeRemovePreference(struct Tree tree, int id, int32_t value) {
-  if (!tree.nodes[id] || value < 0)
+  struct TreeNodes *nodes = tree.nodes;
+  int32_t slot = treeSlot(nodes, id);
+  if (slot == NO_NODE || value < 0)
+    return 0;
+
+  treeUnshare(nodes);
+  treeOwnPreferences(nodes, slot);
+  if (!sortedArrayRemove(nodes->allocator, &nodes->preferences[slot], value))
     return 0;
 
-  return listRemoveElement(tree.nodes[id]->preferences, value);
+  treeInvalidate(nodes, slot);
+
+  // The bounds of the subtrees are not lowered, as that would visit all the
+  // childs of every ancestor; the compaction does it, see [subtree_max]. Only
+  // a leaf knows its bound right away.
+  if (nodes->first_child[slot] == NO_NODE)
+    nodes->subtree_max[slot] = sortedArrayMax(&nodes->preferences[slot]);
+
+  treeCompactAfterChange(nodes);
+  return 1;
 }
 
-static struct List *marathonAux(struct Tree tree, struct TreeNode *curr,
-                                int32_t k, int32_t max_value) {
-  assert(curr);
+// Make the traversal stack big enough for [depth] frames. Aborts with error
+// code 1 if could not allocate memory.
+static void traversalReserve(struct TreeScratch *scratch, int32_t depth) {
+  if (depth <= scratch->frames_capacity)
+    return;
 
-  struct List *res = malloc(sizeof(struct List));
-  (*res) = (struct List){NULL, NULL};
+  int32_t new_capacity = scratch->frames_capacity;
+  while (new_capacity < depth)
+    new_capacity *= 2;
 
-#ifdef DEBUG
-  assert(listIsSorted(curr->preferences));
-#endif
+  struct TraversalFrame *frames =
+      realloc(scratch->frames, sizeof(struct TraversalFrame) * new_capacity);
+  if (!frames)
+    exit(1);
+
+  scratch->frames = frames;
+  scratch->frames_capacity = new_capacity;
+}
+
+// Visit the subtree of [root] without recursion, calling [enter] when a node
+// is reached and [leave] when its whole subtree is done. Childs are visited in
+// the order of the child list.
+static void traverseSubtree(const struct Tree *tree, int32_t root,
+                            traversal_enter enter, traversal_leave leave,
+                            void *context) {
+  struct TreeScratch *scratch = tree->scratch;
+
+  scratch->frames[0].node = root;
+  scratch->frames[0].next_child = tree->nodes->first_child[root];
+  if (!enter(tree, &scratch->frames[0], NULL, context))
+    return;
+
+  int32_t depth = 1;
+  while (depth > 0) {
+    struct TraversalFrame *frame = &scratch->frames[depth - 1];
+
+    if (frame->next_child != NO_NODE) {
+      int32_t child = frame->next_child;
+      frame->next_child = tree->nodes->next_sibling[child];
 
-  // This value will be passed as max_value recuresively to [curr] childs. It
-  // is max of either [max_value], or first element of the [curr->preferences]
-  // list (if one exists).
-  int next_limit = curr->preferences->head
-                       ? MAX(max_value, curr->preferences->head->value)
-                       : max_value;
-
-  listForeach(curr->childs, node, {
-    struct List *partial_res;
-    partial_res = marathonAux(tree, tree.nodes[node->value], k, next_limit);
-    res = listMergeSortedLists(res, partial_res, next_limit, k);
-  });
-
-  int list_size = 0;
-  listForeach(res, node, { ++list_size; });
-
-  // If size of the result list is less than [k], add from the current node
-  // preferences lists.
-  listForeach(curr->preferences, node, {
-    if (list_size < k && node->value > max_value) {
-      listPushBack(res, node->value);
-      list_size++;
+      // The stack may move, so the frames are taken after it is reserved.
+      traversalReserve(scratch, depth + 1);
+      struct TraversalFrame *child_frame = &scratch->frames[depth];
+      child_frame->node = child;
+      child_frame->next_child = tree->nodes->first_child[child];
+
+      if (enter(tree, child_frame, &scratch->frames[depth - 1], context))
+        ++depth;
     } else {
+      leave(tree, frame, depth > 1 ? &scratch->frames[depth - 2] : NULL,
+            context);
+      --depth;
+    }
+  }
+}
+
+// Parameters and the result of a marathon query.
+struct MarathonContext {
+  int32_t k;
+  struct Run res;
+
+  // Values of the root must be greater than this, -1 unless the query is a
+  // part of a parallel marathon.
+  int32_t limit;
+
+  // The k-th best value found by all threads of a parallel marathon, NULL for
+  // a query on a single thread. Nothing below it can get to the result.
+  _Atomic int32_t *shared_bound;
+};
+
+// Let other threads of the marathon skip the values up to [kth_value].
+static void marathonShareBound(struct MarathonContext *query,
+                               int32_t kth_value) {
+  int32_t bound = atomic_load_explicit(query->shared_bound,
+                                       memory_order_relaxed);
+
+  // A failed exchange reloads [bound], another thread could raise it already.
+  while (bound < kth_value) {
+    if (atomic_compare_exchange_weak_explicit(query->shared_bound, &bound,
+                                              kth_value, memory_order_relaxed,
+                                              memory_order_relaxed))
       break;
+  }
+}
+
+// Cached result of [slot] that can be used for a query for [k] values greater
+// than [max_value], or NULL if there is none.
+static const struct MarathonCache *marathonCached(const struct TreeNodes *nodes,
+                                                  int32_t slot,
+                                                  int32_t max_value,
+                                                  int32_t k) {
+  // Views of the tree have no cache.
+  if (!nodes->cache)
+    return NULL;
+
+  const struct MarathonCache *cache = nodes->cache[slot];
+  if (!cache || nodes->stamp[slot] >= cache->generation ||
+      cache->limit > max_value)
+    return NULL;
+
+  // Values cut off by the cached [k] could be needed.
+  if (k > cache->k && cache->size == cache->k)
+    return NULL;
+
+  return cache;
+}
+
+// Store the result of a marathon from [slot] for the next queries.
+static void marathonCache(struct TreeNodes *nodes, int32_t slot, int32_t limit,
+                          int32_t k, const int32_t *values, int32_t size) {
+  struct MarathonCache *cache = nodes->cache[slot];
+  cache = slabResizeBuffer(nodes->allocator, cache,
+                           cache ? marathonCacheSize(cache->size) : 0,
+                           marathonCacheSize(size));
+
+  (*cache) = (struct MarathonCache){++nodes->generation, limit, k, size};
+  memcpy(cache->values, values, sizeof(int32_t) * size);
+  nodes->cache[slot] = cache;
+}
+
+static void marathonFinish(const struct Tree *tree, struct TraversalFrame *frame,
+                           struct TraversalFrame *parent,
+                           struct MarathonContext *query);
+
+// Prepare the [frame] of a node that takes values greater than [max_value].
+static void marathonStart(const struct Tree *tree, struct TraversalFrame *frame,
+                          int32_t max_value) {
+  const struct SortedArray *prefs = &tree->nodes->preferences[frame->node];
+  struct MarathonFrame *marathon = &frame->marathon;
+
+#ifdef DEBUG
+  assert(arrayIsSorted(prefs->values, prefs->size));
+#endif
+
+  marathon->max_value = max_value;
+
+  // This value will be passed as max_value to the node childs. It is max of
+  // either [max_value], or first element of the node preferences (if one
+  // exists).
+  marathon->next_limit = MAX(max_value, sortedArrayMax(prefs));
+
+  marathon->bound = marathon->next_limit;
+  marathon->res = (struct Run){tree->scratch->values->top, 0};
+  marathon->sizes_offset = tree->scratch->run_sizes->top;
+  marathon->total_size = 0;
+  marathon->child_count = 0;
+}
+
+static int marathonEnter(const struct Tree *tree, struct TraversalFrame *frame,
+                         struct TraversalFrame *parent, void *context) {
+  struct MarathonContext *query = context;
+  struct MarathonFrame *marathon = &frame->marathon;
+
+  // The root of a marathon takes all its movies. Other nodes also skip the
+  // values that would not make it to the final result.
+  int32_t max_value = parent ? parent->marathon.bound : query->limit;
+  if (query->shared_bound) {
+    int32_t shared = atomic_load_explicit(query->shared_bound,
+                                          memory_order_relaxed);
+    max_value = MAX(max_value, shared);
+  }
+
+  // No movie in the subtree is good enough to pass through the parent, so
+  // there is no need to visit it.
+  if (parent && tree->nodes->subtree_max[frame->node] <= max_value)
+    return 0;
+
+  marathonStart(tree, frame, max_value);
+
+  // The result is known already, the subtree is not visited.
+  const struct MarathonCache *cache = marathonCached(
+      tree->nodes, frame->node, marathon->max_value, query->k);
+  if (cache) {
+    int32_t taken = 0;
+    while (taken < MIN(cache->size, query->k) &&
+           cache->values[taken] > marathon->max_value)
+      ++taken;
+
+    struct ScratchArena *arena = tree->scratch->values;
+    int64_t offset = arenaPush(arena, taken);
+    memcpy(arenaAt(arena, offset), cache->values, sizeof(int32_t) * taken);
+    marathon->res.size = taken;
+
+    marathonFinish(tree, frame, parent, query);
+    return 0;
+  }
+
+  return 1;
+}
+
+// Merge the result of a child into [parent] result, as soon as the child is
+// done. The child result is placed just after the [parent] one. They are
+// merged above both, and then the merged values are moved down in place of
+// the [parent] result.
+static void marathonMergePairwise(const struct Tree *tree,
+                                  struct MarathonFrame *parent,
+                                  struct Run partial_res, int32_t k) {
+  struct ScratchArena *arena = tree->scratch->values;
+  struct Run *res = &parent->res;
+  assert(res->offset + res->size == partial_res.offset);
+
+  int64_t merged_offset =
+      arenaPush(arena, MIN((int64_t)res->size + partial_res.size, k));
+  int32_t merged_size = mergeSortedArrays(
+      arenaAt(arena, merged_offset), arenaAt(arena, res->offset), res->size,
+      arenaAt(arena, partial_res.offset), partial_res.size, parent->next_limit,
+      k);
+
+  memmove(arenaAt(arena, res->offset), arenaAt(arena, merged_offset),
+          sizeof(int32_t) * merged_size);
+  res->size = merged_size;
+  arenaRewind(arena, res->offset + res->size);
+
+  if (k > 0 && res->size == k)
+    parent->bound = MAX(parent->bound, *arenaAt(arena, res->offset + k - 1));
+}
+
+// Merge the results of all childs of the node at once with a heap. They are
+// placed one after another from the start of the node result, only their
+// sizes were remembered.
+static void marathonMergeHeap(const struct Tree *tree,
+                              struct MarathonFrame *marathon, int32_t k) {
+  struct ScratchArena *arena = tree->scratch->values;
+  struct ScratchArena *run_sizes = tree->scratch->run_sizes;
+  struct MergeScratch *merge = &tree->scratch->merge;
+  struct Run *res = &marathon->res;
+
+  if (marathon->child_count == 1) {
+    // A single child run is already cut to [k] values above the limit.
+    res->size = (int32_t)marathon->total_size;
+  } else if (marathon->child_count == 2 && marathon->total_size > 0) {
+    // Two runs go through the vector merge kernel instead of the heap.
+    int32_t first = *arenaAt(run_sizes, marathon->sizes_offset);
+    int32_t second = *arenaAt(run_sizes, marathon->sizes_offset + 1);
+    int64_t merged_offset = arenaPush(arena, MIN(marathon->total_size, k));
+
+    res->size = mergeSortedArrays(
+        arenaAt(arena, merged_offset), arenaAt(arena, res->offset), first,
+        arenaAt(arena, res->offset + first), second, marathon->next_limit, k);
+    memmove(arenaAt(arena, res->offset), arenaAt(arena, merged_offset),
+            sizeof(int32_t) * res->size);
+  } else if (marathon->total_size > 0) {
+    int64_t merged_offset = arenaPush(arena, MIN(marathon->total_size, k));
+
+    mergeScratchReserve(merge, marathon->child_count);
+    int64_t offset = res->offset;
+    for (int32_t i = 0; i < marathon->child_count; ++i) {
+      int32_t size = *arenaAt(run_sizes, marathon->sizes_offset + i);
+      merge->sources[i] = (struct MergeSource){arenaAt(arena, offset), size};
+      offset += size;
     }
-  });
 
+    res->size = mergeKSortedArrays(arenaAt(arena, merged_offset),
+                                   merge->sources, marathon->child_count,
+                                   merge->heap, marathon->next_limit, k);
+    memmove(arenaAt(arena, res->offset), arenaAt(arena, merged_offset),
+            sizeof(int32_t) * res->size);
+  }
+
+  arenaRewind(arena, res->offset + res->size);
+  arenaRewind(run_sizes, marathon->sizes_offset);
+}
+
+// Complete the result of a node whose childs are all done.
+static void marathonCollect(const struct Tree *tree,
+                            struct TraversalFrame *frame, int32_t k) {
+  struct ScratchArena *arena = tree->scratch->values;
+  struct MarathonFrame *marathon = &frame->marathon;
+  struct Run *res = &marathon->res;
+
+  if (tree->merge == MARATHON_MERGE_HEAP)
+    marathonMergeHeap(tree, marathon, k);
+
+  // If size of the result is less than [k], add from the current node
+  // preferences. They are all smaller than the values from the childs.
+  const struct SortedArray *prefs = &tree->nodes->preferences[frame->node];
+  int32_t taken =
+      MIN(sortedArrayCountGreater(prefs, marathon->max_value), k - res->size);
+  if (taken > 0) {
+    int64_t offset = arenaPush(arena, taken);
+    memcpy(arenaAt(arena, offset), prefs->values, sizeof(int32_t) * taken);
+    res->size += taken;
+  }
+}
+
+static void marathonLeave(const struct Tree *tree, struct TraversalFrame *frame,
+                          struct TraversalFrame *parent, void *context) {
+  struct MarathonContext *query = context;
+
+  marathonCollect(tree, frame, query->k);
+  marathonFinish(tree, frame, parent, query);
+}
+
+// Pass the result of the node to its parent, or to the [query] if it is the
+// root of the marathon.
+static void marathonFinish(const struct Tree *tree, struct TraversalFrame *frame,
+                           struct TraversalFrame *parent,
+                           struct MarathonContext *query) {
+  struct ScratchArena *arena = tree->scratch->values;
+  struct Run *res = &frame->marathon.res;
+
+  if (query->shared_bound && query->k > 0 && res->size == query->k)
+    marathonShareBound(query, *arenaAt(arena, res->offset + res->size - 1));
+
+  if (!parent) {
+    query->res = *res;
+  } else if (tree->merge == MARATHON_MERGE_HEAP) {
+    int64_t size_offset = arenaPush(tree->scratch->run_sizes, 1);
+    *arenaAt(tree->scratch->run_sizes, size_offset) = res->size;
+    parent->marathon.total_size += res->size;
+    parent->marathon.child_count++;
+
+    // The child alone has found [k] values, so the rest of the childs do not
+    // need to look below the worst of them.
+    if (query->k > 0 && res->size == query->k) {
+      int32_t kth_value = *arenaAt(arena, res->offset + res->size - 1);
+      parent->marathon.bound = MAX(parent->marathon.bound, kth_value);
+    }
+  } else {
+    marathonMergePairwise(tree, &parent->marathon, *res, query->k);
+  }
+}
+
+// Insert [value] into [top], a result of a small marathon with [size] places.
+// There are no branches: the value is compared with every place, and each one
+// takes the greatest of itself and the values that could be shifted into it.
+// A value that is already there is turned into -1, which changes nothing.
+#define SMALL_MARATHON_INSERT(top, size, value)                                \
+  do {                                                                         \
+    int __present = 0;                                                         \
+    for (int32_t __i = 0; __i < (size); ++__i)                                 \
+      __present |= (top)[__i] == (value);                                      \
+                                                                               \
+    int32_t __value = __present ? -1 : (value);                                \
+    for (int32_t __i = (size)-1; __i > 0; --__i) {                             \
+      int32_t __shifted = MIN((top)[__i - 1], __value);                        \
+      (top)[__i] = MAX((top)[__i], __shifted);                                 \
+    }                                                                          \
+                                                                               \
+    (top)[0] = MAX((top)[0], __value);                                         \
+  } while (0)
+
+// Define [smallMarathonEnter<places>], which visits a node in a marathon for at
+// most [places] values. The result of the whole query is kept in one array, so
+// nodes only have to take values better than the k-th one found so far.
+#define SMALL_MARATHON_KERNEL(places)                                          \
+  static int smallMarathonEnter##places(                                       \
+      const struct Tree *tree, struct TraversalFrame *frame,                   \
+      struct TraversalFrame *parent, void *context) {                          \
+    struct SmallMarathon *small = context;                                     \
+    const struct TreeNodes *nodes = tree->nodes;                               \
+    int32_t max_value = parent ? parent->marathon.next_limit : -1;             \
+    int32_t limit = MAX(max_value, small->top[small->k - 1]);                  \
+    if (nodes->subtree_max[frame->node] <= limit)                              \
+      return 0;                                                                \
+                                                                               \
+    const struct SortedArray *prefs = &nodes->preferences[frame->node];        \
+    for (int32_t i = 0; i < prefs->size && prefs->values[i] > limit; ++i) {    \
+      SMALL_MARATHON_INSERT(small->top, places, prefs->values[i]);             \
+      limit = MAX(max_value, small->top[small->k - 1]);                        \
+    }                                                                          \
+                                                                               \
+    frame->marathon.next_limit = MAX(max_value, sortedArrayMax(prefs));        \
+    return 1;                                                                  \
+  }
+
+SMALL_MARATHON_KERNEL(1)
+SMALL_MARATHON_KERNEL(2)
+SMALL_MARATHON_KERNEL(4)
+SMALL_MARATHON_KERNEL(8)
+SMALL_MARATHON_KERNEL(16)
+
+// Used as [leave] by the traversals that do everything in [enter].
+static void traversalNoLeave(const struct Tree *tree,
+                             struct TraversalFrame *frame,
+                             struct TraversalFrame *parent, void *context) {
+  (void)tree;
+  (void)frame;
+  (void)parent;
+  (void)context;
+}
+
+// Find the result of a marathon from [slot] for [k] values, where 0 < [k] <=
+// [MARATHON_SMALL_K], without any allocation. Returns the number of values
+// found, they are at the start of [small->top].
+static int32_t runSmallMarathon(const struct Tree *tree, int32_t slot,
+                                int32_t k, struct SmallMarathon *small) {
+  assert(0 < k && k <= MARATHON_SMALL_K);
+  for (int32_t i = 0; i < MARATHON_SMALL_K; ++i)
+    small->top[i] = -1;
+
+  small->k = k;
+
+  // The smallest array that can hold [k] values.
+  traversal_enter enter = smallMarathonEnter16;
+  if (k <= 1)
+    enter = smallMarathonEnter1;
+  else if (k <= 2)
+    enter = smallMarathonEnter2;
+  else if (k <= 4)
+    enter = smallMarathonEnter4;
+  else if (k <= 8)
+    enter = smallMarathonEnter8;
+
+  traverseSubtree(tree, slot, enter, traversalNoLeave, small);
+
+  int32_t size = 0;
+  while (size < k && small->top[size] != -1)
+    ++size;
+
+  return size;
+}
+
+#if MARATHON_PARALLEL
+
+// Subtrees with less nodes are not worth waking the threads.
+#define PARALLEL_MIN_NODES (4096)
+
+// The top of the subtree is split until there are this many tasks for every
+// thread, so the threads that finish early have something to steal.
+#define PARALLEL_TASKS_PER_THREAD (8)
+
+// At most this many nodes are split on the calling thread.
+#define PARALLEL_MAX_SPLIT (1024)
+
+// Part of a parallel marathon: the subtree of [node], whose values must be
+// greater than [limit].
+struct MarathonTask {
+  int32_t node;
+  int32_t limit;
+};
+
+// State of one thread of a parallel marathon.
+struct ParallelWorker {
+  struct TreeScratch *scratch;
+
+  // Merged results of the tasks done by the thread. The merge goes from
+  // [best] to [spare], then they are swapped.
+  int32_t *best, *spare;
+  int32_t best_size, capacity;
+};
+
+struct ParallelMarathon {
+  struct WorkPool *pool;
+  struct ParallelWorker *workers;
+
+  // Nodes of the split top of the subtree, followed by the tasks.
+  struct MarathonTask *tasks;
+  int32_t tasks_capacity;
+
+  // Current query.
+  const struct Tree *tree;
+  int32_t k;
+  _Atomic int32_t bound;
+
+  // Result of the last query.
+  int32_t *result;
+  int32_t result_capacity;
+  struct MergeScratch merge;
+};
+
+// Append [task] to the [count] tasks of [parallel]. Aborts with error code 1
+// if could not allocate memory.
+static void parallelQueue(struct ParallelMarathon *parallel, int32_t *count,
+                          struct MarathonTask task) {
+  if (*count == parallel->tasks_capacity) {
+    int32_t new_capacity = MAX(2 * parallel->tasks_capacity, 64);
+    treeArrayResize(parallel->tasks, new_capacity);
+    parallel->tasks_capacity = new_capacity;
+  }
+
+  parallel->tasks[(*count)++] = task;
+}
+
+// Merge [size] values into the result of [worker]. Aborts with error code 1
+// if could not allocate memory.
+static void parallelKeep(struct ParallelWorker *worker, const int32_t *values,
+                         int32_t size, int32_t k) {
+  int32_t merged = (int32_t)MIN((int64_t)worker->best_size + size, k);
+  if (merged > worker->capacity) {
+    treeArrayResize(worker->best, merged);
+    treeArrayResize(worker->spare, merged);
+    worker->capacity = merged;
+  }
+
+  merged = mergeSortedArrays(worker->spare, worker->best, worker->best_size,
+                             values, size, -1, k);
+
+  int32_t *swap = worker->best;
+  worker->best = worker->spare;
+  worker->spare = swap;
+  worker->best_size = merged;
+}
+
+// Used as [pool_task] of a parallel marathon.
+static void parallelRunTask(void *context, int32_t worker, const void *data) {
+  struct ParallelMarathon *parallel = context;
+  const struct MarathonTask *task = data;
+  struct ParallelWorker *self = &parallel->workers[worker];
+
+  int32_t bound = atomic_load_explicit(&parallel->bound, memory_order_relaxed);
+  if (parallel->tree->nodes->subtree_max[task->node] <= MAX(task->limit, bound))
+    return;
+
+  // The thread has its own scratch memory, the nodes are only read.
+  struct Tree tree = *parallel->tree;
+  tree.scratch = self->scratch;
+
+  struct ScratchArena *arena = tree.scratch->values;
+  struct MarathonContext query = {parallel->k, {0, 0}, task->limit,
+                                  &parallel->bound};
+
+  arenaReset(arena);
+  traverseSubtree(&tree, task->node, marathonEnter, marathonLeave, &query);
+  parallelKeep(self, arenaAt(arena, query.res.offset), query.res.size,
+               parallel->k);
+  arenaReset(arena);
+}
+
+// Number of nodes seen by a traversal, it stops at [limit].
+struct NodeCount {
+  int32_t count, limit;
+};
+
+static int nodeCountEnter(const struct Tree *tree, struct TraversalFrame *frame,
+                          struct TraversalFrame *parent, void *context) {
+  (void)tree;
+  (void)frame;
+  (void)parent;
+
+  struct NodeCount *count = context;
+  return count->count++ < count->limit;
+}
+
+// Run a marathon from [slot] on all threads of the tree. The top of the
+// subtree is split on the calling thread, in breadth-first order, into
+// subtrees that are the tasks of the threads. Returns 0 if the subtree is too
+// small, and nothing was done. Otherwise [values] is set to the result,
+// valid until the next call, and its size is returned in [size]. Aborts with
+// error code 1 if could not allocate memory.
+static int runParallelMarathon(const struct Tree *tree, int32_t slot,
+                               int32_t k, const int32_t **values,
+                               int32_t *size) {
+  struct ParallelMarathon *parallel = tree->parallel;
+  const struct TreeNodes *nodes = tree->nodes;
+
+  struct NodeCount count = {0, PARALLEL_MIN_NODES};
+  traverseSubtree(tree, slot, nodeCountEnter, traversalNoLeave, &count);
+  if (count.count < PARALLEL_MIN_NODES)
+    return 0;
+
+  int32_t threads = poolThreads(parallel->pool);
+  int32_t split = 0, queued = 0;
+  parallelQueue(parallel, &queued, (struct MarathonTask){slot, -1});
+  while (split < queued && split < PARALLEL_MAX_SPLIT &&
+         queued - split < threads * PARALLEL_TASKS_PER_THREAD) {
+    struct MarathonTask task = parallel->tasks[split++];
+    const struct SortedArray *prefs = &nodes->preferences[task.node];
+    int32_t child_limit = MAX(task.limit, sortedArrayMax(prefs));
+
+    for (int32_t child = nodes->first_child[task.node]; child != NO_NODE;
+         child = nodes->next_sibling[child]) {
+      if (nodes->subtree_max[child] > child_limit)
+        parallelQueue(parallel, &queued,
+                      (struct MarathonTask){child, child_limit});
+    }
+  }
+
+  parallel->tree = tree;
+  parallel->k = k;
+  atomic_store(&parallel->bound, -1);
+  for (int32_t i = 0; i < threads; ++i)
+    parallel->workers[i].best_size = 0;
+
+  poolRun(parallel->pool, parallel->tasks + split, queued - split,
+          sizeof(struct MarathonTask), parallelRunTask, parallel);
+
+  // The preferences of the split nodes and the results of the threads are
+  // merged at once.
+  struct MergeScratch *merge = &parallel->merge;
+  mergeScratchReserve(merge, split + threads);
+  int32_t sources = 0;
+  int64_t total = 0;
+  for (int32_t i = 0; i < split; ++i) {
+    const struct SortedArray *prefs =
+        &nodes->preferences[parallel->tasks[i].node];
+    int32_t taken =
+        MIN(sortedArrayCountGreater(prefs, parallel->tasks[i].limit), k);
+    merge->sources[sources++] = (struct MergeSource){prefs->values, taken};
+    total += taken;
+  }
+
+  for (int32_t i = 0; i < threads; ++i) {
+    struct ParallelWorker *worker = &parallel->workers[i];
+    merge->sources[sources++] =
+        (struct MergeSource){worker->best, worker->best_size};
+    total += worker->best_size;
+  }
+
+  int32_t capacity = (int32_t)MIN(total, k);
+  if (capacity > parallel->result_capacity) {
+    treeArrayResize(parallel->result, capacity);
+    parallel->result_capacity = capacity;
+  }
+
+  *size = mergeKSortedArrays(parallel->result, merge->sources, sources,
+                             merge->heap, -1, k);
+  *values = parallel->result;
+  return 1;
+}
+
+#else
+
+static int runParallelMarathon(const struct Tree *tree, int32_t slot,
+                               int32_t k, const int32_t **values,
+                               int32_t *size) {
+  (void)tree;
+  (void)slot;
+  (void)k;
+  (void)values;
+  (void)size;
+
+  return 0;
+}
+
+#endif
+
+void treeSetThreads(struct Tree *tree, int32_t threads) {
+#if MARATHON_PARALLEL
+  struct ParallelMarathon *parallel = tree->parallel;
+  if (parallel) {
+    int32_t old_threads = poolThreads(parallel->pool);
+    poolDestroy(parallel->pool);
+    for (int32_t i = 0; i < old_threads; ++i) {
+      treeScratchDestroy(parallel->workers[i].scratch);
+      free(parallel->workers[i].best);
+      free(parallel->workers[i].spare);
+    }
+
+    free(parallel->workers);
+    free(parallel->tasks);
+    free(parallel->result);
+    mergeScratchFree(&parallel->merge);
+    free(parallel);
+    tree->parallel = NULL;
+  }
+
+  if (threads <= 1)
+    return;
+
+  // The threads must not race to choose the merge kernel.
+  mergeInit();
+
+  parallel = malloc(sizeof(struct ParallelMarathon));
+  if (!parallel)
+    exit(1);
+
+  parallel->workers = malloc(sizeof(struct ParallelWorker) * threads);
+  if (!parallel->workers)
+    exit(1);
+
+  for (int32_t i = 0; i < threads; ++i)
+    parallel->workers[i] =
+        (struct ParallelWorker){treeScratchCreate(), NULL, NULL, 0, 0};
+
+  parallel->pool = poolCreate(threads);
+  parallel->tasks = NULL;
+  parallel->tasks_capacity = 0;
+  parallel->result = NULL;
+  parallel->result_capacity = 0;
+  parallel->merge = (struct MergeScratch){NULL, NULL, 0};
+  tree->parallel = parallel;
+#else
+  (void)tree;
+  (void)threads;
+#endif
+}
+
+// Copy [size] values to the top of [arena].
+static struct Run arenaKeep(struct ScratchArena *arena, const int32_t *values,
+                            int32_t size) {
+  struct Run res = {arenaPush(arena, size), size};
+  memcpy(arenaAt(arena, res.offset), values, sizeof(int32_t) * size);
   return res;
 }
 
 struct List *runMarathon(struct Tree tree, int root, int32_t k) {
-  if (!tree.nodes[root] || k < 0)
+  int32_t slot = treeSlot(tree.nodes, root);
+  if (slot == NO_NODE || k < 0)
+    return NULL;
+
+  struct ScratchArena *arena = tree.scratch->values;
+
+  struct MarathonContext query = {k, {0, 0}, -1, NULL};
+  int cached = marathonCached(tree.nodes, slot, -1, k) != NULL;
+
+  const int32_t *values;
+  int32_t size;
+
+  arenaReset(arena);
+  if (!cached && 0 < k && k <= MARATHON_SMALL_K) {
+    // Small results do not need the arena to be found, only to be returned.
+    struct SmallMarathon small;
+    size = runSmallMarathon(&tree, slot, k, &small);
+    query.res = arenaKeep(arena, small.top, size);
+  } else if (!cached && tree.parallel &&
+             runParallelMarathon(&tree, slot, k, &values, &size)) {
+    query.res = arenaKeep(arena, values, size);
+  } else {
+    traverseSubtree(&tree, slot, marathonEnter, marathonLeave, &query);
+  }
+
+  if (!cached && k <= tree.cache_k)
+    marathonCache(tree.nodes, slot, -1, k, arenaAt(arena, query.res.offset),
+                  query.res.size);
+
+  // Only the final values leave the arena.
+  struct List *res = listCreate(tree.allocator);
+  for (int32_t i = 0; i < query.res.size; ++i)
+    listPushBack(tree.allocator, res, *arenaAt(arena, query.res.offset + i));
+
+  arenaReset(arena);
+  return res;
+}
+
+int32_t runViewMarathon(struct Tree view, struct TreeScratch *scratch,
+                        int32_t node, int32_t k, const int32_t **values) {
+  assert(node != NO_NODE && k >= 0);
+
+  // The results are not cached, the view is only read.
+  view.scratch = scratch;
+  struct ScratchArena *arena = scratch->values;
+  struct MarathonContext query = {k, {0, 0}, -1, NULL};
+
+  arenaReset(arena);
+  int32_t size;
+  if (0 < k && k <= MARATHON_SMALL_K) {
+    struct SmallMarathon small;
+    size = runSmallMarathon(&view, node, k, &small);
+    query.res = arenaKeep(arena, small.top, size);
+  } else if (k > 0 && view.parallel &&
+             runParallelMarathon(&view, node, k, values, &size)) {
+    return size;
+  } else {
+    traverseSubtree(&view, node, marathonEnter, marathonLeave, &query);
+  }
+
+  *values = arenaAt(arena, query.res.offset);
+  return query.res.size;
+}
+
+struct WorkPool *treePool(struct Tree tree) {
+#if MARATHON_PARALLEL
+  return tree.parallel ? tree.parallel->pool : NULL;
+#else
+  (void)tree;
+  return NULL;
+#endif
+}
+
+// Add [entry] to the frontier of [iter]. Aborts with error code 1 if could not
+// allocate memory.
+static void frontierPush(struct MarathonIter *iter, struct FrontierEntry entry) {
+  if (iter->frontier_size == iter->frontier_capacity) {
+    int32_t new_capacity = MAX(2 * iter->frontier_capacity, 64);
+    struct FrontierEntry *frontier =
+        realloc(iter->frontier, sizeof(struct FrontierEntry) * new_capacity);
+    if (!frontier)
+      exit(1);
+
+    iter->frontier = frontier;
+    iter->frontier_capacity = new_capacity;
+  }
+
+  struct FrontierEntry *heap = iter->frontier;
+  int32_t idx = iter->frontier_size++;
+  while (idx > 0 && heap[(idx - 1) / 2].key < entry.key) {
+    heap[idx] = heap[(idx - 1) / 2];
+    idx = (idx - 1) / 2;
+  }
+
+  heap[idx] = entry;
+}
+
+// Put [entry] in place of the top of the frontier and restore the heap order.
+static void frontierReplaceTop(struct MarathonIter *iter,
+                               struct FrontierEntry entry) {
+  struct FrontierEntry *heap = iter->frontier;
+  int32_t size = iter->frontier_size;
+  int32_t idx = 0;
+  for (;;) {
+    int32_t child = 2 * idx + 1;
+    if (child >= size)
+      break;
+
+    if (child + 1 < size && heap[child + 1].key > heap[child].key)
+      ++child;
+
+    if (heap[child].key <= entry.key)
+      break;
+
+    heap[idx] = heap[child];
+    idx = child;
+  }
+
+  heap[idx] = entry;
+}
+
+// Remove the top of the frontier.
+static void frontierPop(struct MarathonIter *iter) {
+  struct FrontierEntry last = iter->frontier[--iter->frontier_size];
+  if (iter->frontier_size > 0)
+    frontierReplaceTop(iter, last);
+}
+
+// Visit [node], whose values must be greater than [limit]. Its greatest
+// preference and its childs that can give anything go to the frontier.
+static void marathonIterVisit(struct MarathonIter *iter, int32_t node,
+                              int32_t limit) {
+  const struct TreeNodes *nodes = iter->nodes;
+  const struct SortedArray *prefs = &nodes->preferences[node];
+  if (prefs->size > 0 && prefs->values[0] > limit)
+    frontierPush(iter, (struct FrontierEntry){prefs->values[0], node, 0, limit});
+
+  int32_t child_limit = MAX(limit, sortedArrayMax(prefs));
+  for (int32_t child = nodes->first_child[node]; child != NO_NODE;
+       child = nodes->next_sibling[child]) {
+    if (nodes->subtree_max[child] > child_limit) {
+      frontierPush(iter, (struct FrontierEntry){nodes->subtree_max[child],
+                                                child, NO_NODE, child_limit});
+    }
+  }
+}
+
+// Put the root in the frontier, so the subtree is visited for the values
+// smaller than the ones returned so far.
+static void marathonIterStartFrontier(struct MarathonIter *iter) {
+  int32_t root = iter->root;
+  if (iter->nodes->subtree_max[root] > -1) {
+    frontierPush(iter, (struct FrontierEntry){iter->nodes->subtree_max[root],
+                                              root, NO_NODE, -1});
+  }
+}
+
+struct MarathonIter *marathonIterBegin(struct Tree tree, int root,
+                                       int32_t expected) {
+  int32_t slot = treeSlot(tree.nodes, root);
+  if (slot == NO_NODE)
     return NULL;
 
-  return marathonAux(tree, tree.nodes[root], k, -1);
+  struct MarathonIter *iter = &tree.scratch->iter;
+  iter->nodes = tree.nodes;
+  iter->root = slot;
+  iter->frontier_size = 0;
+  iter->head = NULL;
+  iter->head_index = 0;
+  iter->last = INT64_MAX;
+  iter->pulled = 0;
+  iter->done = 0;
+  iter->record = tree.scratch->values;
+  iter->cache_k = tree.cache_k;
+  iter->recording = tree.cache_k > 0;
+  arenaReset(iter->record);
+
+  const struct MarathonCache *cache =
+      marathonCached(tree.nodes, slot, -1, expected);
+  if (cache) {
+    iter->head = cache->values;
+    iter->head_size = cache->size;
+    iter->head_k = cache->k;
+    iter->recording = 0;
+  } else if (0 < expected && expected <= MARATHON_SMALL_K) {
+    iter->head = iter->small.top;
+    iter->head_size = runSmallMarathon(&tree, slot, expected, &iter->small);
+    iter->head_k = expected;
+  } else if (expected > 0 && tree.parallel &&
+             runParallelMarathon(&tree, slot, expected, &iter->head,
+                                 &iter->head_size)) {
+    iter->head_k = expected;
+  } else {
+    marathonIterStartFrontier(iter);
+  }
+
+  return iter;
+}
+
+// Next value of the frontier not smaller than the last one, or
+// [MARATHON_ITER_DONE].
+static int32_t marathonIterPull(struct MarathonIter *iter) {
+  while (iter->frontier_size > 0) {
+    struct FrontierEntry top = iter->frontier[0];
+    if (top.index == NO_NODE) {
+      frontierPop(iter);
+      marathonIterVisit(iter, top.node, top.limit);
+      continue;
+    }
+
+    // The next preference of the node takes the place of this one.
+    const struct SortedArray *prefs = &iter->nodes->preferences[top.node];
+    int32_t next = top.index + 1;
+    if (next < prefs->size && prefs->values[next] > top.limit) {
+      frontierReplaceTop(iter, (struct FrontierEntry){prefs->values[next],
+                                                      top.node, next,
+                                                      top.limit});
+    } else {
+      frontierPop(iter);
+    }
+
+    // The same movie can be liked by many users.
+    if (top.key < iter->last)
+      return top.key;
+  }
+
+  return MARATHON_ITER_DONE;
+}
+
+int32_t marathonIterNext(struct MarathonIter *iter) {
+  if (iter->done)
+    return MARATHON_ITER_DONE;
+
+  int32_t value;
+  if (iter->head && iter->head_index < iter->head_size) {
+    value = iter->head[iter->head_index++];
+  } else if (iter->head && iter->head_size < iter->head_k) {
+    // There are no more values than the ones already known.
+    value = MARATHON_ITER_DONE;
+  } else {
+    if (iter->head) {
+      // The rest of the values is below the known ones.
+      iter->head = NULL;
+      marathonIterStartFrontier(iter);
+    }
+
+    value = marathonIterPull(iter);
+  }
+
+  if (value == MARATHON_ITER_DONE) {
+    iter->done = 1;
+    return value;
+  }
+
+  iter->last = value;
+  iter->pulled++;
+  if (iter->recording && iter->pulled <= iter->cache_k)
+    *arenaAt(iter->record, arenaPush(iter->record, 1)) = value;
+  else
+    iter->recording = 0;
+
+  return value;
+}
+
+void marathonIterEnd(struct MarathonIter *iter) {
+  // A complete result is good for any k, other ones for as many values as
+  // were taken.
+  if (iter->recording && (iter->pulled > 0 || iter->done)) {
+    marathonCache(iter->nodes, iter->root, -1,
+                  iter->done ? INT32_MAX : iter->pulled,
+                  arenaAt(iter->record, 0), iter->pulled);
+  }
+
+  arenaReset(iter->record);
+  iter->frontier_size = 0;
+}
+
+// Parameters of a marathon from every node.
+struct MarathonAllContext {
+  struct MarathonContext query;
+  marathon_result emit;
+  void *emit_context;
+};
+
+// Every node computes its own result, as if it was the root of a marathon, so
+// nothing is pruned.
+static int marathonAllEnter(const struct Tree *tree,
+                            struct TraversalFrame *frame,
+                            struct TraversalFrame *parent, void *context) {
+  (void)parent;
+  (void)context;
+
+  marathonStart(tree, frame, -1);
+  return 1;
+}
+
+static void marathonAllLeave(const struct Tree *tree,
+                             struct TraversalFrame *frame,
+                             struct TraversalFrame *parent, void *context) {
+  struct MarathonAllContext *all = context;
+  struct ScratchArena *arena = tree->scratch->values;
+  struct Run *res = &frame->marathon.res;
+
+  marathonCollect(tree, frame, all->query.k);
+  const int32_t *values = arenaAt(arena, res->offset);
+  all->emit(all->emit_context, tree->nodes->id_of[frame->node], values,
+            res->size);
+
+  if (!parent)
+    return;
+
+  // The parent takes only the values greater than its preferences. They are
+  // a prefix of the result, and still the best [k] of them.
+  int32_t passed = 0;
+  while (passed < res->size && values[passed] > parent->marathon.next_limit)
+    ++passed;
+
+  res->size = passed;
+  arenaRewind(arena, res->offset + passed);
+  marathonFinish(tree, frame, parent, &all->query);
+}
+
+void runMarathonAll(struct Tree tree, int32_t k, marathon_result emit,
+                    void *context) {
+  struct MarathonAllContext all = {{k, {0, 0}, -1, NULL}, emit, context};
+
+  arenaReset(tree.scratch->values);
+  traverseSubtree(&tree, 0, marathonAllEnter, marathonAllLeave, &all);
+  arenaReset(tree.scratch->values);
+}
+
+// Counts stored in the first section of a snapshot of the tree. The next
+// sections are the node arrays [id_of], [first_child], [last_child],
+// [next_sibling], [prev_sibling] and [subtree_max], the parent of every slot,
+// the number of preferences of every slot, the entries of [slot_of], and all
+// the preferences, slot after slot.
+struct TreeSnapshotInfo {
+  int64_t count;
+  int64_t map_capacity, map_size;
+  int64_t value_count;
+};
+
+// Write the node array [array] as a section of the snapshot.
+#define treeSnapshotArray(writer, nodes, array)                                \
+  ({                                                                           \
+    snapshotWrite((writer), (nodes)->array,                                    \
+                  sizeof(*(nodes)->array) * (nodes)->count);                   \
+    snapshotEndSection((writer));                                              \
+  })
+
+void treeWrite(struct Tree tree, struct SnapshotWriter *writer) {
+  struct TreeNodes *nodes = tree.nodes;
+  struct TreeSnapshotInfo info = {nodes->count, nodes->slot_of.capacity,
+                                  nodes->slot_of.size, 0};
+  for (int32_t slot = 0; slot < nodes->count; ++slot)
+    info.value_count += nodes->preferences[slot].size;
+
+  snapshotWrite(writer, &info, sizeof(info));
+  snapshotEndSection(writer);
+
+  treeSnapshotArray(writer, nodes, id_of);
+  treeSnapshotArray(writer, nodes, first_child);
+  treeSnapshotArray(writer, nodes, last_child);
+  treeSnapshotArray(writer, nodes, next_sibling);
+  treeSnapshotArray(writer, nodes, prev_sibling);
+  treeSnapshotArray(writer, nodes, subtree_max);
+
+  // The groups are not saved, only the parents they lead to. Finding them
+  // only moves the nodes to other groups, nothing is allocated.
+  for (int32_t slot = 0; slot < nodes->count; ++slot) {
+    int32_t parent = slot == 0 ? NO_NODE : treeParent(nodes, slot);
+    snapshotWrite(writer, &parent, sizeof(parent));
+  }
+  snapshotEndSection(writer);
+
+  for (int32_t slot = 0; slot < nodes->count; ++slot)
+    snapshotWrite(writer, &nodes->preferences[slot].size, sizeof(int32_t));
+  snapshotEndSection(writer);
+
+  snapshotWrite(writer, nodes->slot_of.entries,
+                sizeof(struct IdMapEntry) * nodes->slot_of.capacity);
+  snapshotEndSection(writer);
+
+  for (int32_t slot = 0; slot < nodes->count; ++slot)
+    snapshotWrite(writer, nodes->preferences[slot].values,
+                  sizeof(int32_t) * nodes->preferences[slot].size);
+  snapshotEndSection(writer);
+}
+
+int treeSave(struct Tree tree, const char *path, uint64_t sequence) {
+  struct SnapshotWriter writer;
+  if (!snapshotWriterOpen(&writer, path))
+    return 0;
+
+  treeWrite(tree, &writer);
+  return snapshotWriterClose(&writer, sequence);
+}
+
+// Check the counts of a snapshot, so the arrays they describe can be read.
+static int treeSnapshotInfoIsValid(const struct TreeSnapshotInfo *info) {
+  int64_t capacity = info->map_capacity;
+  return info->count >= 1 && info->count < INT32_MAX &&
+         info->map_size == info->count && capacity > 0 &&
+         capacity <= INT32_MAX && (capacity & (capacity - 1)) == 0 &&
+         2 * info->map_size <= capacity && info->value_count >= 0;
+}
+
+// Copy the section of the snapshot with node array [array] into [nodes].
+// Returns 0 if the snapshot is too short.
+#define treeLoadArray(snapshot, nodes, array)                                  \
+  ({                                                                           \
+    size_t __size = sizeof(*(nodes)->array) * (nodes)->count;                  \
+    const void *__section = snapshotSection((snapshot), __size);               \
+    if (__section)                                                             \
+      memcpy((nodes)->array, __section, __size);                               \
+    __section != NULL;                                                         \
+  })
+
+// Check that a link of a loaded node is [NO_NODE] or a used slot.
+#define treeLoadedLink(nodes, link)                                            \
+  ((link) == NO_NODE || inRange(0, (nodes)->count - 1, (link)))
+
+// Check the nodes read from a snapshot: every slot is found by its id, the
+// links lead to used slots, the childlist of every node holds exactly the
+// slots with it as the [parent], and all nodes can be reached from the root.
+static int treeLoadedLinksAreValid(const struct TreeNodes *nodes,
+                                   const int32_t *parent) {
+  int32_t count = nodes->count;
+  for (int32_t slot = 0; slot < count; ++slot) {
+    if (nodes->id_of[slot] < 0 ||
+        idMapGet(&nodes->slot_of, nodes->id_of[slot]) != slot ||
+        !treeLoadedLink(nodes, nodes->first_child[slot]) ||
+        !treeLoadedLink(nodes, nodes->last_child[slot]) ||
+        !treeLoadedLink(nodes, nodes->next_sibling[slot]) ||
+        !treeLoadedLink(nodes, nodes->prev_sibling[slot]))
+      return 0;
+  }
+
+  if (nodes->next_sibling[0] != NO_NODE || nodes->prev_sibling[0] != NO_NODE)
+    return 0;
+
+  // A slot that is in a childlist twice, or in a cycle, has a wrong
+  // [prev_sibling] the second time.
+  int32_t childs = 0;
+  for (int32_t slot = 0; slot < count; ++slot) {
+    int32_t prev = NO_NODE;
+    for (int32_t child = nodes->first_child[slot]; child != NO_NODE;
+         child = nodes->next_sibling[child]) {
+      if (parent[child] != slot || nodes->prev_sibling[child] != prev ||
+          ++childs >= count)
+        return 0;
+
+      prev = child;
+    }
+
+    if (nodes->last_child[slot] != prev)
+      return 0;
+  }
+
+  if (childs != count - 1)
+    return 0;
+
+  // Nodes in a cycle of parents have right childlists, but the walk in
+  // pre-order from the root does not get to them.
+  int32_t reached = 1;
+  for (int32_t curr = nodes->first_child[0]; curr != NO_NODE; ++reached) {
+    int32_t next = nodes->first_child[curr];
+    for (; next == NO_NODE && curr != 0; curr = parent[curr])
+      next = nodes->next_sibling[curr];
+
+    curr = next;
+  }
+
+  return reached == count;
+}
+
+// Check the preferences read from a snapshot, [sizes] of them for every slot
+// in [values]: they are sorted in decreasing order and not negative, and
+// [subtree_max] is an upper bound of the ones in every subtree.
+static int treeLoadedValuesAreValid(const struct TreeNodes *nodes,
+                                    const int32_t *sizes,
+                                    const int32_t *values) {
+  for (int32_t slot = 0; slot < nodes->count; ++slot) {
+    int32_t size = sizes[slot];
+    for (int32_t i = 0; i < size; ++i)
+      if (values[i] < 0 || (i > 0 && values[i] >= values[i - 1]))
+        return 0;
+
+    int32_t subtree_max = size ? values[0] : -1;
+    for (int32_t child = nodes->first_child[slot]; child != NO_NODE;
+         child = nodes->next_sibling[child])
+      subtree_max = MAX(subtree_max, nodes->subtree_max[child]);
+
+    if (nodes->subtree_max[slot] < subtree_max)
+      return 0;
+
+    values += size;
+  }
+
+  return 1;
+}
+
+// Fill [nodes], made with [treeNodesCreate], from the rest of the [snapshot].
+// Returns 0 if the snapshot does not describe a valid tree.
+static int treeLoadNodes(struct TreeNodes *nodes, struct Snapshot *snapshot,
+                         const struct TreeSnapshotInfo *info) {
+  if (!treeLoadArray(snapshot, nodes, id_of) ||
+      !treeLoadArray(snapshot, nodes, first_child) ||
+      !treeLoadArray(snapshot, nodes, last_child) ||
+      !treeLoadArray(snapshot, nodes, next_sibling) ||
+      !treeLoadArray(snapshot, nodes, prev_sibling) ||
+      !treeLoadArray(snapshot, nodes, subtree_max))
+    return 0;
+
+  int32_t count = nodes->count;
+  const int32_t *parent = snapshotSection(snapshot, sizeof(int32_t) * count);
+  const int32_t *sizes = snapshotSection(snapshot, sizeof(int32_t) * count);
+  const struct IdMapEntry *entries = snapshotSection(
+      snapshot, sizeof(struct IdMapEntry) * info->map_capacity);
+  const int32_t *values =
+      snapshotSection(snapshot, sizeof(int32_t) * info->value_count);
+  if (!parent || !sizes || !entries || !values || parent[0] != NO_NODE ||
+      nodes->id_of[0] != 0)
+    return 0;
+
+  int64_t value_count = 0;
+  for (int32_t slot = 0; slot < count; ++slot) {
+    if ((slot > 0 && !inRange(0, count - 1, parent[slot])) || sizes[slot] < 0)
+      return 0;
+
+    value_count += sizes[slot];
+  }
+
+  if (value_count != info->value_count ||
+      !idMapLoad(&nodes->slot_of, entries, info->map_capacity,
+                 info->map_size) ||
+      !treeLoadedLinksAreValid(nodes, parent) ||
+      !treeLoadedValuesAreValid(nodes, sizes, values))
+    return 0;
+
+  // Every node gets a fresh group, and its childs join it.
+  for (int32_t slot = 0; slot < count; ++slot)
+    nodes->own_group[slot] = groupCreate(&nodes->groups, slot);
+
+  nodes->group[0] = NO_NODE;
+  for (int32_t slot = 1; slot < count; ++slot) {
+    nodes->group[slot] = nodes->own_group[parent[slot]];
+    groupAcquire(&nodes->groups, nodes->group[slot]);
+  }
+
+  // The preferences are not copied, they are read from the mapped file until
+  // they change.
+  for (int32_t slot = 0; slot < count; ++slot) {
+    sortedArrayBorrow(&nodes->preferences[slot], values, sizes[slot]);
+    values += sizes[slot];
+    nodes->cache[slot] = NULL;
+    nodes->stamp[slot] = 0;
+    nodes->pref_epoch[slot] = 0;
+  }
+
+  return 1;
+}
+
+int treeLoad(struct Tree tree, const char *path, uint64_t *sequence) {
+  struct Snapshot snapshot;
+  if (!snapshotOpen(&snapshot, path))
+    return 0;
+
+  const struct TreeSnapshotInfo *info =
+      snapshotSection(&snapshot, sizeof(struct TreeSnapshotInfo));
+  if (!info || !treeSnapshotInfoIsValid(info)) {
+    snapshotClose(&snapshot);
+    return 0;
+  }
+
+  struct TreeNodes loaded;
+  treeNodesCreate(&loaded, tree.allocator,
+                  MAX((int32_t)info->count, TREE_INITIAL_CAPACITY));
+  loaded.count = info->count;
+  if (!treeLoadNodes(&loaded, &snapshot, info)) {
+    // Nothing was borrowed from the snapshot yet.
+    loaded.count = 0;
+    treeNodesFree(&loaded);
+    snapshotClose(&snapshot);
+    return 0;
+  }
+
+  if (sequence)
+    (*sequence) = snapshot.sequence;
+
+  treeNodesFree(tree.nodes);
+  loaded.snapshot = snapshot;
+  (*tree.nodes) = loaded;
+  return 1;
+}
+
+struct SlabStats treeMemoryStats(struct Tree tree) {
+  return slabStats(tree.allocator);
 }
 
 #ifdef DEBUG
 
-static void printSubtree(struct Tree tree, int curr_id) {
-  struct TreeNode *curr = tree.nodes[curr_id];
-  assert(curr);
-  printf("%d [ ", curr->id);
-  listForeach(curr->preferences, node, { printf("%d ", node->value); });
+static int printEnter(const struct Tree *tree, struct TraversalFrame *frame,
+                      struct TraversalFrame *parent, void *context) {
+  (void)parent;
+  (void)context;
+
+  int32_t curr = frame->node;
+  printf("%d [ ", tree->nodes->id_of[curr]);
+  for (int32_t i = 0; i < tree->nodes->preferences[curr].size; ++i)
+    printf("%d ", tree->nodes->preferences[curr].values[i]);
   printf("]: ");
-  listForeach(curr->childs, node, { printf("%d ", node->value); });
+  for (int32_t child = tree->nodes->first_child[curr]; child != NO_NODE;
+       child = tree->nodes->next_sibling[child])
+    printf("%d ", tree->nodes->id_of[child]);
   printf("\n");
-  listForeach(curr->childs, node, { printSubtree(tree, node->value); });
+
+  return 1;
+}
+
+static void printLeave(const struct Tree *tree, struct TraversalFrame *frame,
+                       struct TraversalFrame *parent, void *context) {
+  (void)tree;
+  (void)frame;
+  (void)parent;
+  (void)context;
 }
 
 void printTree(struct Tree tree) {
   printf("Tree state:\n");
-  printSubtree(tree, 0);
+  traverseSubtree(&tree, 0, printEnter, printLeave, NULL);
+
+  struct SlabStats stats = treeMemoryStats(tree);
+  printf("Memory: %ld live objects, %ld slabs, %.2f%% fragmentation\n",
+         (long)stats.live_objects, (long)stats.slabs,
+         stats.fragmentation * 100.0);
   printf("\n");
 }
 
@@ -6,20 +6,59 @@
 
 #include <stdint.h>
 
-// We represent tree as an array of nodes, coz it is the only way we can access
-// any vertex in constant time.
+#include "slab.h"
+
+// How a marathon combines the results computed for the childs of a node.
+enum marathon_merge {
+  // Fold the child results one by one into the node result.
+  MARATHON_MERGE_PAIRWISE,
+
+  // Merge all child results at once with a heap.
+  MARATHON_MERGE_HEAP
+};
+
+// We represent tree as parallel arrays of nodes, coz it is the only way we can
+// access any vertex in constant time, and a traversal only reads a few
+// contiguous arrays. Nodes are moved now and then, so that every subtree is
+// stored in one piece, in pre-order. The preference values, the cached
+// results and the lists returned by [runMarathon] are allocated from
+// [allocator].
 struct Tree {
-  struct TreeNode **nodes;
-  int32_t size;
+  struct TreeNodes *nodes;
+
+  struct SlabAllocator *allocator;
+
+  // Scratch memory of traversals and marathon queries.
+  struct TreeScratch *scratch;
+
+  enum marathon_merge merge;
+
+  // Results of marathons for at most this many values are cached at the root
+  // of the query, until a preference in its subtree changes. 0 turns the
+  // cache off.
+  int32_t cache_k;
+
+  // Threads that run the marathons on big subtrees, NULL if there is only one.
+  struct ParallelMarathon *parallel;
 };
 
-// Inicialize the tree data scrucutre.
+// Default value of [cache_k].
+#define MARATHON_DEFAULT_CACHE_K (128)
+
+// Inicialize the tree data scrucutre, with user 0 only. The tree grows when
+// users are added, any non-negative int32 can be an id.
 // Aborts with error code 1 if could not allocate memory.
-struct Tree initTree(int32_t size);
+struct Tree initTree(void);
 
-// Free the tree and all related memeory that was allocated.
+// Free the tree and all related memeory that was allocated. No view of the
+// tree may be read anymore.
 void freeTree(struct Tree tree);
 
+// Run the marathons on [threads] threads, 1 stops the other threads. Has no
+// effect if built with MARATHON_PARALLEL=0. Aborts with error code 1 if could
+// not allocate memory or start a thread.
+void treeSetThreads(struct Tree *tree, int32_t threads);
+
 // Add [id] as a child of [parent]. Returns 0 of failure, 1 on success.
 // Aborts with error code 1 if could not allocate memory.
 int treeAddNode(struct Tree tree, int id, int parent);
@@ -34,8 +73,113 @@ int treeAddPreference(struct Tree tree, int id, int32_t value);
 // Remove preference [value] from node [id].
 int treeRemovePreference(struct Tree tree, int id, int32_t value);
 
+// Run a marathon from [root] for at most [k] values and return them as a list
+// in descending order, allocated from [allocator]. Returns NULL if there is no
+// such user or [k] is negative. Aborts with error code 1 if could not
+// allocate memory.
 struct List *runMarathon(struct Tree tree, int root, int32_t k);
 
+// Scratch memory of a thread that runs marathons with [runViewMarathon].
+// Aborts with error code 1 if could not allocate memory.
+struct TreeScratch *treeScratchCreate(void);
+
+void treeScratchDestroy(struct TreeScratch *scratch);
+
+// Take a view of the tree as it is now, for marathons on other threads while
+// the tree keeps changing. The view shares the memory of the tree until it
+// changes; then the changed memory is copied, and the view keeps the old one
+// until it is released. Views of a tree that did not change are the same.
+// Returns the epoch of the view, views are numbered from 1 in the order they
+// were taken. Aborts with error code 1 if could not allocate memory.
+uint64_t treeViewTake(struct Tree tree, struct Tree *view);
+
+// Node of the user [id] in the view taken now, or -1 if there is no such user.
+int32_t treeViewNode(struct Tree tree, int id);
+
+// Tell the tree that the views older than [epoch] are no longer read, so the
+// memory kept for them is freed.
+void treeViewsRelease(struct Tree tree, uint64_t epoch);
+
+// Marathon from [node] of a [view] for [k] values. Many of them can run at once
+// on different threads, each with its own [scratch]. It runs on the threads of
+// the tree if [view.parallel] is set; then no other marathon may use them at
+// the same time. Returns the number of values, [values] is set to the result,
+// valid until the next marathon with [scratch] or the threads. Aborts with
+// error code 1 if could not allocate memory.
+int32_t runViewMarathon(struct Tree view, struct TreeScratch *scratch,
+                        int32_t node, int32_t k, const int32_t **values);
+
+// Pool of the threads of the tree, NULL if there is only one.
+struct WorkPool *treePool(struct Tree tree);
+
+// Marathon that finds its values one by one, in descending order. It only
+// visits the part of the subtree needed for the values taken so far.
+struct MarathonIter;
+
+// Returned by [marathonIterNext] when there are no more values.
+#define MARATHON_ITER_DONE (-1)
+
+// Start a marathon from [root]. Returns NULL if there is no such user. Only one
+// iterator of the tree can be used at a time, and the tree must not change
+// until it ends. [expected] is how many values will likely be taken, a cached
+// result is used only if it has enough of them.
+struct MarathonIter *marathonIterBegin(struct Tree tree, int root,
+                                       int32_t expected);
+
+// Next value of the marathon, or [MARATHON_ITER_DONE]. Aborts with error code
+// 1 if could not allocate memory.
+int32_t marathonIterNext(struct MarathonIter *iter);
+
+// Finish the marathon. The values taken so far are cached in the root.
+void marathonIterEnd(struct MarathonIter *iter);
+
+// Receives the result of a marathon from the user [id]: [size] values, in
+// descending order.
+typedef void (*marathon_result)(void *context, int id, const int32_t *values,
+                                int32_t size);
+
+// Run a marathon from every user in a single pass, reusing the results of the
+// childs. [emit] is called for every user, in post-order.
+void runMarathonAll(struct Tree tree, int32_t k, marathon_result emit,
+                    void *context);
+
+// Move all nodes so that they are stored in pre-order, and recompute the
+// bounds of the preferences in every subtree. This is also done a few nodes at
+// a time when users are added or deleted or preferences removed, after enough
+// of them were. Marathons never move nodes.
+void treeCompact(struct Tree tree);
+
+// Upper bound of the preferences in the subtree of [id], -1 if there are none
+// or there is no such user. Marathons skip the subtrees whose bound is too
+// small.
+int32_t treeSubtreeBound(struct Tree tree, int id);
+
+// Writer of a snapshot file, see snapshot.h.
+struct SnapshotWriter;
+
+// Write the nodes and the preferences of the tree to the [writer]. Nothing is
+// allocated, so it can be done in a child forked by a process with other
+// threads.
+void treeWrite(struct Tree tree, struct SnapshotWriter *writer);
+
+// Write the nodes and the preferences of the tree to a snapshot file at
+// [path], with the [sequence] number in its header. Returns 1 on success, 0 if
+// the file could not be written. Aborts with error code 1 if could not
+// allocate memory.
+int treeSave(struct Tree tree, const char *path, uint64_t sequence);
+
+// Replace the whole tree with the one saved at [path]. The file is mapped, the
+// node arrays are copied from it and the preferences are read from it until
+// they change. Returns 1 on success, 0 if the file could not be read or is not
+// a valid snapshot; the tree is not changed then. The [sequence] number of the
+// snapshot is stored in [sequence], unless it is NULL. No view of the tree may
+// be read anymore. Aborts with error code 1 if could not allocate memory.
+int treeLoad(struct Tree tree, const char *path, uint64_t *sequence);
+
+// Memory statistics of the allocator of the tree: the preference values, the
+// cached results and the result lists.
+struct SlabStats treeMemoryStats(struct Tree tree);
+
 #ifdef DEBUG
 
 // Print the tree state to the screen.
@@ -6,61 +6,83 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <limits.h>
+#include <unistd.h>
 
 #include "utils.h"
 
-// Convert number stored as array of chars into int32. Return -1 when a numer is
-// wrong format, or is greater then INT_MAX. Trailing zeros are not supported!
-static int32_t stringToInt32(const char *str, int len) {
-  // For sure in in range of int32. Dont allow for trailing zeros.
-  if (!inRange(1, 10, len) || (str[0] == '0' && len > 1))
-    return -1;
-
-  int32_t res = 0;
-  for (int i = 0; i < len; ++i) {
-    assert(inRange('0', '9', str[i]));
-
-    // Check borders when we are close to INT_MAX.
-    if (i == 9 && (res > INT_MAX / 10 ||
-                   (res == INT_MAX / 10 && str[i] - '0' > INT_MAX % 10))) {
-      return -1;
-    }
-
-    res *= 10;
-    res += str[i] - '0';
-  }
+// Mask with the highest bit set in every byte of [word] that is not a digit.
+// The low seven bits are added separately, so no byte carries to the next one.
+static uint64_t nonDigitBytes(uint64_t word) {
+  uint64_t offset = word ^ 0x3030303030303030ULL;
+  return (((offset & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | offset) &
+         0x8080808080808080ULL;
+}
+
+// Value of the [length] digits at the beginning of [word], [length] in [1, 8].
+// Digits are moved to the top of the word and summed in pairs, quads and
+// halves, with one multiplication each.
+static uint64_t digitsValue(uint64_t word, int length) {
+  assert(inRange(1, 8, length));
 
-  return res;
+  word = (word & 0x0F0F0F0F0F0F0F0FULL) << (8 * (8 - length));
+  word = (word * (10 * 256 + 1)) >> 8;
+  word = ((word & 0x00FF00FF00FF00FFULL) * (100 * 65536 + 1)) >> 16;
+  return ((word & 0x0000FFFF0000FFFFULL) * (10000 * 4294967296ULL + 1)) >> 32;
 }
 
-// Read int from a [buffer], staring from [idx_in_buffer]. Store value in
-// [result]. If failed, returns 0, else 1.
-static int readInt32FromBuffer(const char *buffer, int *idx_in_buffer,
+// Read int from a [buffer]. Store value in [result] and the number of its
+// digits in [length]. If failed, returns 0, else 1. Leading zeros and numbers
+// greater than INT_MAX are not supported!
+static int readInt32FromBuffer(const char *buffer, int *length,
                                int32_t *result) {
-  int letters_read = 0;
-  while (inRange('0', '9', buffer[(*idx_in_buffer) + letters_read]))
-    ++letters_read;
-
-  int res_converted = stringToInt32(buffer + (*idx_in_buffer), letters_read);
-  (*idx_in_buffer) += letters_read;
-  if (res_converted != -1) {
-    (*result) = res_converted;
+  uint64_t first = loadWord(buffer);
+  uint64_t first_mask = nonDigitBytes(first);
+  if (first_mask) {
+    *length = __builtin_ctzll(first_mask) / 8;
+
+    // Dont allow for leading zeros.
+    if (*length == 0 || (buffer[0] == '0' && *length > 1))
+      return 0;
+
+    *result = digitsValue(first, *length);
     return 1;
-  } else
+  }
+
+  if (buffer[0] == '0')
+    return 0;
+
+  // For sure in in range of int64, the borders of int32 are checked after.
+  uint64_t second = loadWord(buffer + 8);
+  uint64_t second_mask = nonDigitBytes(second);
+  int rest = second_mask ? __builtin_ctzll(second_mask) / 8 : 8;
+  if (rest > 2)
+    return 0;
+
+  uint64_t value = digitsValue(first, 8);
+  if (rest > 0)
+    value = value * (rest == 1 ? 10 : 100) + digitsValue(second, rest);
+
+  if (value > INT_MAX)
     return 0;
+
+  *length = 8 + rest;
+  *result = value;
+  return 1;
 }
 
 int readNumbersFromBuffer(const char *buffer, int amount, int32_t *res) {
-  int idx_in_buffer = 0;
   for (int i = 0; i < amount; ++i) {
-    if (!(readInt32FromBuffer(buffer, &idx_in_buffer, res + i)))
+    int length;
+    if (!readInt32FromBuffer(buffer, &length, res + i))
       return 0;
 
     // Numbers must be separated with single space, and have a terminating
-    // \0 just after the last one.
-    if (buffer[idx_in_buffer++] != ((i < amount - 1) ? ' ' : '\0'))
+    // \n just after the last one.
+    buffer += length;
+    if (*buffer++ != ((i < amount - 1) ? ' ' : '\n'))
       return 0;
   }
 
@@ -79,3 +101,19 @@ int prefixMatch(const char *text, const char *pattern) {
 
   return 1;
 }
+
+int writeAll(int fd, const void *data, size_t size) {
+  const char *bytes = data;
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return 0;
+
+    bytes += written;
+    size -= written;
+  }
+
+  return 1;
+}
@@ -4,7 +4,9 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #define SWAP(first, second)                                                    \
   ({                                                                           \
@@ -20,6 +22,13 @@
     _a >= _b ? _a : _b;                                                        \
   })
 
+#define MIN(first, second)                                                     \
+  ({                                                                           \
+    __typeof((first)) _a = (first);                                            \
+    __typeof((second)) _b = (second);                                          \
+    _a <= _b ? _a : _b;                                                        \
+  })
+
 // 1 if 'min <= value <= max', 0 in other case. Assumes min <= max.
 int inRange(const int32_t min, const int32_t max, const int32_t value);
 
@@ -27,9 +36,39 @@ int inRange(const int32_t min, const int32_t max, const int32_t value);
 // [pattern] must terminate with '\0'.
 int prefixMatch(const char *text, const char *pattern);
 
+// Write all [size] bytes of [data] to the file [fd], retrying interrupted and
+// partial writes. Returns 1 on success, 0 on a write error.
+int writeAll(int fd, const void *data, size_t size);
+
+// Number of readable bytes needed after the '\n' ending a line given to
+// [readNumbersFromBuffer], it reads whole words and not single characters.
+#define READ_NUMBERS_PADDING (16)
+
+// Get 8 characters from [text] as a word, the first one in the lowest byte.
+static inline uint64_t loadWord(const char *text) {
+  uint64_t word;
+  memcpy(&word, text, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+// Get 4 bytes from [bytes] as an int32_t, the lowest one first.
+static inline int32_t loadInt32(const char *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap32(value);
+#endif
+  return value;
+}
+
 // Read [amount] of numbers from a [buffer], and store them in [res]. Assumes
 // that there is enough space allocated at [res] to store all numbres. values in
-// the buffer must be separated with a single space. Returns 1on sucess, else 0.
+// the buffer must be separated with a single space and the last one must be
+// followed by '\n', which ends the line. There must be [READ_NUMBERS_PADDING]
+// readable bytes after it. Returns 1on sucess, else 0.
 int readNumbersFromBuffer(const char *buffer, int amount, int32_t *res);
 
 #endif
@@ -0,0 +1,210 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include "work_pool.h"
+
+#if MARATHON_PARALLEL
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+// Tasks of one worker, as indices into the tasks of the round. The owner takes
+// them from the back, other workers steal from the front.
+struct WorkDeque {
+  pthread_mutex_t lock;
+  int32_t *tasks;
+  int32_t front, back, capacity;
+};
+
+struct PoolWorker {
+  struct WorkPool *pool;
+  int32_t id;
+};
+
+struct WorkPool {
+  int32_t threads;
+  pthread_t *handles;
+  struct PoolWorker *workers;
+  struct WorkDeque *deques;
+
+  // Guards the fields below. [start] is signalled when a new round begins,
+  // [finish] when the last thread is done with it.
+  pthread_mutex_t lock;
+  pthread_cond_t start, finish;
+
+  int64_t round;
+  int32_t running;
+  int stop;
+
+  // Tasks of the current round.
+  const char *tasks;
+  size_t task_size;
+  pool_task run;
+  void *context;
+};
+
+// Take the next task for [worker], its own one if there is any. Returns 0 if
+// all deques are empty.
+static int poolTake(struct WorkPool *pool, int32_t worker, int32_t *task) {
+  struct WorkDeque *own = &pool->deques[worker];
+  pthread_mutex_lock(&own->lock);
+  int found = own->front < own->back;
+  if (found)
+    *task = own->tasks[--own->back];
+  pthread_mutex_unlock(&own->lock);
+
+  for (int32_t i = 1; !found && i < pool->threads; ++i) {
+    struct WorkDeque *victim = &pool->deques[(worker + i) % pool->threads];
+    pthread_mutex_lock(&victim->lock);
+    found = victim->front < victim->back;
+    if (found)
+      *task = victim->tasks[victim->front++];
+    pthread_mutex_unlock(&victim->lock);
+  }
+
+  return found;
+}
+
+// Run tasks until there are none left in the pool.
+static void poolWork(struct WorkPool *pool, int32_t worker) {
+  int32_t task;
+  while (poolTake(pool, worker, &task))
+    pool->run(pool->context, worker, pool->tasks + pool->task_size * task);
+}
+
+static void *poolThread(void *arg) {
+  struct PoolWorker *self = arg;
+  struct WorkPool *pool = self->pool;
+  int64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->round == seen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+
+    if (pool->stop)
+      break;
+
+    seen = pool->round;
+    pthread_mutex_unlock(&pool->lock);
+
+    poolWork(pool, self->id);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0)
+      pthread_cond_signal(&pool->finish);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+struct WorkPool *poolCreate(int32_t threads) {
+  assert(threads > 0);
+  struct WorkPool *pool = malloc(sizeof(struct WorkPool));
+  if (!pool)
+    exit(1);
+
+  pool->threads = threads;
+  pool->handles = malloc(sizeof(pthread_t) * threads);
+  pool->workers = malloc(sizeof(struct PoolWorker) * threads);
+  pool->deques = malloc(sizeof(struct WorkDeque) * threads);
+  if (!pool->handles || !pool->workers || !pool->deques)
+    exit(1);
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->finish, NULL);
+  pool->round = 0;
+  pool->running = 0;
+  pool->stop = 0;
+
+  for (int32_t i = 0; i < threads; ++i) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].tasks = NULL;
+    pool->deques[i].front = pool->deques[i].back = 0;
+    pool->deques[i].capacity = 0;
+    pool->workers[i] = (struct PoolWorker){pool, i};
+  }
+
+  // Worker 0 is the thread that calls [poolRun].
+  for (int32_t i = 1; i < threads; ++i)
+    if (pthread_create(&pool->handles[i], NULL, poolThread, &pool->workers[i]))
+      exit(1);
+
+  return pool;
+}
+
+void poolDestroy(struct WorkPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int32_t i = 1; i < pool->threads; ++i)
+    pthread_join(pool->handles[i], NULL);
+
+  for (int32_t i = 0; i < pool->threads; ++i) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->finish);
+  free(pool->handles);
+  free(pool->workers);
+  free(pool->deques);
+  free(pool);
+}
+
+int32_t poolThreads(const struct WorkPool *pool) { return pool->threads; }
+
+void poolRun(struct WorkPool *pool, const void *tasks, int32_t count,
+             size_t task_size, pool_task run, void *context) {
+  // The other threads wait for the round, so the deques are filled without
+  // locks. Taking [pool->lock] below publishes them.
+  int32_t per_worker = count / pool->threads + 1;
+  for (int32_t i = 0; i < pool->threads; ++i) {
+    struct WorkDeque *deque = &pool->deques[i];
+    if (deque->capacity < per_worker) {
+      int32_t *resized = realloc(deque->tasks, sizeof(int32_t) * per_worker);
+      if (!resized)
+        exit(1);
+
+      deque->tasks = resized;
+      deque->capacity = per_worker;
+    }
+
+    deque->front = deque->back = 0;
+  }
+
+  for (int32_t i = 0; i < count; ++i) {
+    struct WorkDeque *deque = &pool->deques[i % pool->threads];
+    deque->tasks[deque->back++] = i;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->tasks = tasks;
+  pool->task_size = task_size;
+  pool->run = run;
+  pool->context = context;
+  pool->running = pool->threads - 1;
+  pool->round++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  poolWork(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running > 0)
+    pthread_cond_wait(&pool->finish, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+#endif
@@ -0,0 +1,44 @@
+// Mateusz Dudziński
+// IPP, 2018L Task: "Maraton filmowy".
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Build with -DMARATHON_PARALLEL=0 for a single-threaded program without
+// pthreads. The pool is then never created and every marathon runs on the
+// calling thread.
+#ifndef MARATHON_PARALLEL
+#define MARATHON_PARALLEL (1)
+#endif
+
+// Runs one task on the worker [worker], in [0, threads).
+typedef void (*pool_task)(void *context, int32_t worker, const void *task);
+
+#if MARATHON_PARALLEL
+
+struct WorkPool;
+
+// Start [threads] - 1 threads; the thread calling [poolRun] is one more
+// worker. Aborts with error code 1 if could not allocate memory or start a
+// thread.
+struct WorkPool *poolCreate(int32_t threads);
+
+// Stop and join all threads.
+void poolDestroy(struct WorkPool *pool);
+
+int32_t poolThreads(const struct WorkPool *pool);
+
+// Run [run] for each of [count] tasks of [task_size] bytes from [tasks], and
+// return when all are done. Tasks are dealt to the workers in turns. A worker
+// takes its own tasks from the back, and when it has no more, it steals from
+// the front of the others. The calling thread is worker 0. Aborts with error
+// code 1 if could not allocate memory.
+void poolRun(struct WorkPool *pool, const void *tasks, int32_t count,
+             size_t task_size, pool_task run, void *context);
+
+#endif
+
+#endif